@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include "submission_pool.cpp"
+
+// Runs compute work (culling, simulation, post-processing) on a dedicated
+// compute queue family so it overlaps with rasterization. Command buffers
+// come from a SubmissionPool on the compute queue and are recycled once the
+// submission's fence has signaled; the semaphore the graphics submission
+// waits on is handed in by the caller. Buffers written here change queue
+// family with a release barrier on the compute side and a matching acquire
+// barrier on the graphics side.
+class AsyncCompute
+{
+  public:
+	void create(vk::Device device, vk::Queue queue, uint32_t computeFamily, uint32_t graphicsFamily)
+	{
+		this->computeFamily  = computeFamily;
+		this->graphicsFamily = graphicsFamily;
+
+		if (!isAsync())
+		{
+			return;
+		}
+
+		submissions.create(device, queue, computeFamily);
+	}
+
+	void destroy()
+	{
+		submissions.destroy();
+	}
+
+	// without a dedicated family the work is recorded into the graphics command buffer instead
+	bool isAsync() const
+	{
+		return computeFamily != graphicsFamily;
+	}
+
+	// recycles the command buffers of completed compute submissions, call once per frame
+	void collect()
+	{
+		if (isAsync())
+		{
+			submissions.collect();
+		}
+	}
+
+	vk::CommandBuffer begin()
+	{
+		return submissions.beginCommands();
+	}
+
+	// signals finished once the compute work is done, for the graphics submission to wait on
+	SubmissionTicket submit(vk::CommandBuffer commandBuffer, vk::Semaphore finished)
+	{
+		return submissions.submit(commandBuffer, {}, {}, {finished});
+	}
+
+	SubmissionPoolStats stats() const
+	{
+		return submissions.stats();
+	}
+
+	// hands a buffer written by the compute queue over to the graphics queue
+	void releaseBuffer(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::PipelineStageFlags srcStage, vk::AccessFlags srcAccess)
+	{
+		auto barrier          = ownershipBarrier(buffer);
+		barrier.srcAccessMask = srcAccess;
+
+		commandBuffer.pipelineBarrier(srcStage, vk::PipelineStageFlagBits::eBottomOfPipe, {}, nullptr, barrier, nullptr);
+	}
+
+	// recorded on the graphics queue, matches releaseBuffer
+	void acquireBuffer(vk::CommandBuffer commandBuffer, vk::Buffer buffer, vk::PipelineStageFlags dstStage, vk::AccessFlags dstAccess)
+	{
+		auto barrier          = ownershipBarrier(buffer);
+		barrier.dstAccessMask = dstAccess;
+
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, dstStage, {}, nullptr, barrier, nullptr);
+	}
+
+	// Nothing is transferred back to the compute family: the compute pass
+	// overwrites these buffers every frame, and ownership transfers can be
+	// skipped when the previous contents do not matter.
+
+  private:
+	uint32_t       computeFamily;
+	uint32_t       graphicsFamily;
+	SubmissionPool submissions;
+
+	vk::BufferMemoryBarrier ownershipBarrier(vk::Buffer buffer)
+	{
+		auto barrier                = vk::BufferMemoryBarrier();
+		barrier.srcQueueFamilyIndex = computeFamily;
+		barrier.dstQueueFamilyIndex = graphicsFamily;
+		barrier.buffer              = buffer;
+		barrier.offset              = 0;
+		barrier.size                = VK_WHOLE_SIZE;
+		return barrier;
+	}
+};
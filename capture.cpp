@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "render_thread.cpp"
+
+// Capture files hold every packet sent to the renderer, grouped by
+// simulation tick, so a run can be replayed frame for frame:
+//
+//   header     magic, version, layout sizes, tick rate, rng seed, window size
+//   per tick   uint32 packet count, then per packet a uint8 type (the index
+//              in RenderPacket) followed by its fields
+//
+// Values are stored in the byte order of the machine, which is little
+// endian everywhere we run.
+const char     CAPTURE_MAGIC[4] = {'T', 'G', 'C', 'P'};
+const uint32_t CAPTURE_VERSION  = 4;
+
+// packet types are stored as variant indices, new packets go at the end of RenderPacket
+static_assert(std::is_same_v<std::variant_alternative_t<0, RenderPacket>, SetTransformPacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<1, RenderPacket>, UpdateVerticesPacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<2, RenderPacket>, AddObjectPacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<3, RenderPacket>, DrawListPacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<4, RenderPacket>, ResizePacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<5, RenderPacket>, StreamChunksPacket>);
+static_assert(std::is_same_v<std::variant_alternative_t<6, RenderPacket>, DrawSpritesPacket>);
+
+struct CaptureHeader
+{
+	uint32_t tickRate;
+	uint64_t seed;        // seeds the simulation random numbers
+	uint32_t width;
+	uint32_t height;
+};
+
+class CaptureWriter
+{
+  public:
+	CaptureWriter(const std::string &path, const CaptureHeader &header) :
+	    file(path, std::ios::binary | std::ios::trunc)
+	{
+		if (!file)
+		{
+			throw std::runtime_error("failed to open capture file for writing!");
+		}
+
+		file.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+		write(file, CAPTURE_VERSION);
+		write(file, static_cast<uint32_t>(sizeof(Vertex)));
+		write(file, static_cast<uint32_t>(sizeof(DrawItem)));
+		write(file, static_cast<uint32_t>(sizeof(ChunkInstance)));
+		write(file, static_cast<uint32_t>(sizeof(Sprite)));
+		write(file, header.tickRate);
+		write(file, header.seed);
+		write(file, header.width);
+		write(file, header.height);
+	}
+
+	// buffered until the tick ends
+	void record(const RenderPacket &packet)
+	{
+		tick.push_back(static_cast<char>(packet.index()));
+		std::visit([this](const auto &p) { writePacket(p); }, packet);
+		tickPackets++;
+	}
+
+	void endTick()
+	{
+		write(file, tickPackets);
+		file.write(tick.data(), tick.size());
+		tick.clear();
+		tickPackets = 0;
+		ticks++;
+	}
+
+	uint32_t tickCount() const
+	{
+		return ticks;
+	}
+
+  private:
+	std::ofstream     file;
+	std::vector<char> tick;
+	uint32_t          tickPackets = 0;
+	uint32_t          ticks       = 0;
+
+	template <typename T>
+	static void write(std::ostream &stream, const T &value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		stream.write(reinterpret_cast<const char *>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	void append(const T *values, size_t count)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		auto bytes = reinterpret_cast<const char *>(values);
+		tick.insert(tick.end(), bytes, bytes + sizeof(T) * count);
+	}
+
+	template <typename T>
+	void append(const T &value)
+	{
+		append(&value, 1);
+	}
+
+	void writePacket(const SetTransformPacket &packet)
+	{
+		append(packet.transform);
+	}
+
+	void writePacket(const UpdateVerticesPacket &packet)
+	{
+		append(static_cast<uint32_t>(packet.vertices.size()));
+		append(packet.vertices.data(), packet.vertices.size());
+	}
+
+	void writePacket(const AddObjectPacket &packet)
+	{
+		append(packet.model);
+		append(packet.tint);
+	}
+
+	void writePacket(const DrawListPacket &packet)
+	{
+		append(static_cast<uint32_t>(packet.items.size()));
+		append(packet.items.data(), packet.items.size());
+	}
+
+	void writePacket(const ResizePacket &packet)
+	{
+		append(packet.width);
+		append(packet.height);
+	}
+
+	void writePacket(const StreamChunksPacket &packet)
+	{
+		append(static_cast<uint32_t>(packet.instances.size()));
+		append(packet.instances.data(), packet.instances.size());
+	}
+
+	void writePacket(const DrawSpritesPacket &packet)
+	{
+		append(static_cast<uint32_t>(packet.sprites.size()));
+		append(packet.sprites.data(), packet.sprites.size());
+	}
+};
+
+class CaptureReader
+{
+  public:
+	explicit CaptureReader(const std::string &path) :
+	    file(path, std::ios::binary)
+	{
+		if (!file)
+		{
+			throw std::runtime_error("failed to open capture file!");
+		}
+
+		char magic[sizeof(CAPTURE_MAGIC)];
+		file.read(magic, sizeof(magic));
+		if (!file || std::memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0)
+		{
+			throw std::runtime_error("not a capture file!");
+		}
+
+		if (read<uint32_t>() != CAPTURE_VERSION)
+		{
+			throw std::runtime_error("unsupported capture version!");
+		}
+
+		// vertices, draw items, chunk instances and sprites are stored raw
+		if (read<uint32_t>() != sizeof(Vertex) || read<uint32_t>() != sizeof(DrawItem) || read<uint32_t>() != sizeof(ChunkInstance) ||
+		    read<uint32_t>() != sizeof(Sprite))
+		{
+			throw std::runtime_error("capture was written with a different vertex layout!");
+		}
+
+		header.tickRate = read<uint32_t>();
+		header.seed     = read<uint64_t>();
+		header.width    = read<uint32_t>();
+		header.height   = read<uint32_t>();
+	}
+
+	const CaptureHeader &getHeader() const
+	{
+		return header;
+	}
+
+	// returns false at the end of the capture
+	bool nextTick(std::vector<RenderPacket> &packets)
+	{
+		packets.clear();
+
+		uint32_t count;
+		file.read(reinterpret_cast<char *>(&count), sizeof(count));
+		if (file.eof() && file.gcount() == 0)
+		{
+			return false;
+		}
+		if (!file)
+		{
+			throw std::runtime_error("capture file is truncated!");
+		}
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			packets.push_back(readPacket(read<uint8_t>()));
+		}
+		return true;
+	}
+
+  private:
+	std::ifstream file;
+	CaptureHeader header;
+
+	template <typename T>
+	T read()
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		T value;
+		file.read(reinterpret_cast<char *>(&value), sizeof(T));
+		if (!file)
+		{
+			throw std::runtime_error("capture file is truncated!");
+		}
+		return value;
+	}
+
+	template <typename T>
+	std::vector<T> readArray()
+	{
+		std::vector<T> values(read<uint32_t>());
+		file.read(reinterpret_cast<char *>(values.data()), sizeof(T) * values.size());
+		if (!file)
+		{
+			throw std::runtime_error("capture file is truncated!");
+		}
+		return values;
+	}
+
+	RenderPacket readPacket(uint8_t type)
+	{
+		switch (type)
+		{
+			case 0:
+				return SetTransformPacket{read<glm::mat4>()};
+			case 1:
+				return UpdateVerticesPacket{readArray<Vertex>()};
+			case 2:
+			{
+				auto model = read<glm::mat4>();
+				return AddObjectPacket{model, read<glm::vec4>()};
+			}
+			case 3:
+				return DrawListPacket{readArray<DrawItem>()};
+			case 4:
+			{
+				auto width = read<uint32_t>();
+				return ResizePacket{width, read<uint32_t>()};
+			}
+			case 5:
+				return StreamChunksPacket{readArray<ChunkInstance>()};
+			case 6:
+				return DrawSpritesPacket{readArray<Sprite>()};
+			default:
+				throw std::runtime_error("unknown packet in capture file!");
+		}
+	}
+};
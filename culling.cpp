@@ -0,0 +1,141 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <vector>
+
+#include "lod.cpp"
+#include "vertexData.cpp"
+
+const uint32_t CULL_WORKGROUP_SIZE = 64;
+
+// must match the push_constant block in cull.comp
+struct CullConstants
+{
+	glm::mat4 cullMatrix;        // the shader extracts the frustum planes from it, they would not fit next to the lod data
+	float     lodScale;
+	uint32_t  objectBuffer;        // bindless slots of the input/output buffers
+	uint32_t  drawBuffer;
+	uint32_t  countBuffer;
+	uint32_t  meshBuffer;
+	uint32_t  objectCount;
+};
+
+// largest scale of a model matrix, applied to bounding sphere radii
+static float maxScale(const glm::mat4 &model)
+{
+	return std::max({glm::length(glm::vec3(model[0])),
+	                 glm::length(glm::vec3(model[1])),
+	                 glm::length(glm::vec3(model[2]))});
+}
+
+static glm::vec4 matrixRow(const glm::mat4 &m, int i)
+{
+	return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+}
+
+// xyz is the plane normal pointing inside, w the distance
+struct Frustum
+{
+	std::array<glm::vec4, 6> planes;
+
+	// Gribb/Hartmann extraction, clip space depth is [0, 1] in vulkan
+	static Frustum fromMatrix(const glm::mat4 &m)
+	{
+		auto row = [&m](int i) { return matrixRow(m, i); };
+
+		Frustum frustum;
+		frustum.planes[0] = row(3) + row(0);        // left
+		frustum.planes[1] = row(3) - row(0);        // right
+		frustum.planes[2] = row(3) + row(1);        // top
+		frustum.planes[3] = row(3) - row(1);        // bottom
+		frustum.planes[4] = row(2);                 // near
+		frustum.planes[5] = row(3) - row(2);        // far
+
+		for (auto &plane : frustum.planes)
+		{
+			plane /= glm::length(glm::vec3(plane));
+		}
+
+		return frustum;
+	}
+
+	// same test as cull.comp, used when indirect count draws are not available
+	bool isSphereVisible(const glm::mat4 &model, const glm::vec4 &sphere) const
+	{
+		glm::vec3 center = glm::vec3(model * glm::vec4(glm::vec3(sphere), 1.0f));
+		float     radius = sphere.w * maxScale(model);
+
+		for (const auto &plane : planes)
+		{
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+};
+
+// Projected size of objects for level of detail selection, same as
+// cull.comp. A unit along y covers lodScale / w pixels at clip space w,
+// which is 1 everywhere for the orthographic projection.
+struct LodProjection
+{
+	glm::vec4 wRow;
+	float     lodScale;
+
+	static LodProjection fromMatrix(const glm::mat4 &m, float viewportHeight)
+	{
+		return {matrixRow(m, 3), lodScaleOf(m, viewportHeight)};
+	}
+
+	static float lodScaleOf(const glm::mat4 &m, float viewportHeight)
+	{
+		return 0.5f * viewportHeight * glm::length(glm::vec3(matrixRow(m, 1)));
+	}
+
+	// pixels per mesh unit at the bounding sphere center
+	float pixelsPerUnit(const glm::mat4 &model, const glm::vec4 &sphere) const
+	{
+		float w = glm::dot(wRow, model * glm::vec4(glm::vec3(sphere), 1.0f));
+
+		// at or behind the eye, keep the full mesh
+		if (w <= 0.0f)
+		{
+			return std::numeric_limits<float>::max();
+		}
+
+		return lodScale * maxScale(model) / w;
+	}
+
+	uint32_t select(const MeshLods &lods, const glm::mat4 &model, const glm::vec4 &sphere) const
+	{
+		return selectLod(lods, pixelsPerUnit(model, sphere));
+	}
+};
+
+// bounding sphere around the axis aligned box of the vertices
+static glm::vec4 computeBoundingSphere(const std::vector<Vertex> &vertices)
+{
+	glm::vec2 min = vertices[0].pos;
+	glm::vec2 max = vertices[0].pos;
+	for (const auto &vertex : vertices)
+	{
+		min = glm::min(min, vertex.pos);
+		max = glm::max(max, vertex.pos);
+	}
+
+	glm::vec2 center = (min + max) * 0.5f;
+	float     radius = 0.0f;
+	for (const auto &vertex : vertices)
+	{
+		radius = std::max(radius, glm::length(vertex.pos - center));
+	}
+
+	return glm::vec4(center, 0.0f, radius);
+}
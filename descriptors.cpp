@@ -0,0 +1,165 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <vector>
+
+// bindings of the global descriptor set, shaders index into them with push constants
+const uint32_t BINDLESS_STORAGE_BUFFER_BINDING = 0;
+const uint32_t BINDLESS_SAMPLED_IMAGE_BINDING  = 1;
+
+const uint32_t MAX_BINDLESS_STORAGE_BUFFERS = 1024;
+const uint32_t MAX_BINDLESS_SAMPLED_IMAGES  = 4096;
+
+// One large descriptor set shared by every pipeline. Resources are registered
+// once and referenced by slot index, so switching objects/materials never
+// binds a descriptor set.
+class BindlessDescriptors
+{
+  public:
+	vk::DescriptorSetLayout layout;
+	vk::DescriptorSet       set;
+
+	void create(vk::Device device, vk::PhysicalDevice physicalDevice)
+	{
+		this->device = device;
+
+		auto  properties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingProperties>();
+		auto &indexing   = properties.get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+
+		storageBufferCapacity = std::min({MAX_BINDLESS_STORAGE_BUFFERS,
+		                                  indexing.maxDescriptorSetUpdateAfterBindStorageBuffers,
+		                                  indexing.maxPerStageDescriptorUpdateAfterBindStorageBuffers});
+		// combined image samplers count as samplers and as sampled images
+		sampledImageCapacity = std::min({MAX_BINDLESS_SAMPLED_IMAGES,
+		                                 indexing.maxDescriptorSetUpdateAfterBindSampledImages,
+		                                 indexing.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		                                 indexing.maxDescriptorSetUpdateAfterBindSamplers,
+		                                 indexing.maxPerStageDescriptorUpdateAfterBindSamplers});
+
+		// both bindings are visible to every stage, so together they must fit one stage's limit
+		if (storageBufferCapacity + sampledImageCapacity > indexing.maxPerStageUpdateAfterBindResources)
+		{
+			storageBufferCapacity = std::min(storageBufferCapacity, indexing.maxPerStageUpdateAfterBindResources / 2);
+			sampledImageCapacity  = std::min(sampledImageCapacity, indexing.maxPerStageUpdateAfterBindResources - storageBufferCapacity);
+		}
+
+		std::array<vk::DescriptorSetLayoutBinding, 2> bindings = {
+		    vk::DescriptorSetLayoutBinding(BINDLESS_STORAGE_BUFFER_BINDING, vk::DescriptorType::eStorageBuffer, storageBufferCapacity, vk::ShaderStageFlagBits::eAll),
+		    vk::DescriptorSetLayoutBinding(BINDLESS_SAMPLED_IMAGE_BINDING, vk::DescriptorType::eCombinedImageSampler, sampledImageCapacity, vk::ShaderStageFlagBits::eAll)};
+
+		// slots are filled lazily and may be rewritten while older frames are still in flight
+		vk::DescriptorBindingFlags bindingFlag = vk::DescriptorBindingFlagBits::ePartiallyBound |
+		                                         vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+		                                         vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+
+		std::array<vk::DescriptorBindingFlags, 2> bindingFlags = {bindingFlag, bindingFlag};
+
+		auto bindingFlagsInfo = vk::DescriptorSetLayoutBindingFlagsCreateInfo(static_cast<uint32_t>(bindingFlags.size()), bindingFlags.data());
+
+		auto layoutInfo = vk::DescriptorSetLayoutCreateInfo(
+		    vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool,
+		    static_cast<uint32_t>(bindings.size()),
+		    bindings.data(),
+		    &bindingFlagsInfo);
+		layout = device.createDescriptorSetLayout(layoutInfo);
+
+		std::array<vk::DescriptorPoolSize, 2> poolSizes = {
+		    vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, storageBufferCapacity),
+		    vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, sampledImageCapacity)};
+
+		auto poolInfo = vk::DescriptorPoolCreateInfo(
+		    vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+		    1,        // max sets
+		    static_cast<uint32_t>(poolSizes.size()),
+		    poolSizes.data());
+		pool = device.createDescriptorPool(poolInfo);
+
+		auto allocInfo = vk::DescriptorSetAllocateInfo(pool, 1, &layout);
+		set            = device.allocateDescriptorSets(allocInfo)[0];
+	}
+
+	void destroy()
+	{
+		device.destroyDescriptorPool(pool);
+		device.destroyDescriptorSetLayout(layout);
+	}
+
+	uint32_t registerStorageBuffer(vk::Buffer buffer, vk::DeviceSize offset = 0, vk::DeviceSize range = VK_WHOLE_SIZE)
+	{
+		uint32_t index = allocateSlot(freeStorageBuffers, nextStorageBuffer, storageBufferCapacity);
+
+		auto bufferInfo = vk::DescriptorBufferInfo(buffer, offset, range);
+		auto write      = vk::WriteDescriptorSet(set, BINDLESS_STORAGE_BUFFER_BINDING, index, 1, vk::DescriptorType::eStorageBuffer, nullptr, &bufferInfo);
+		device.updateDescriptorSets(1, &write, 0, nullptr);
+
+		return index;
+	}
+
+	uint32_t registerSampledImage(vk::ImageView imageView, vk::Sampler sampler)
+	{
+		uint32_t index = allocateSlot(freeSampledImages, nextSampledImage, sampledImageCapacity);
+		updateSampledImage(index, imageView, sampler);
+		return index;
+	}
+
+	void updateSampledImage(uint32_t index, vk::ImageView imageView, vk::Sampler sampler)
+	{
+		auto imageInfo = vk::DescriptorImageInfo(sampler, imageView, vk::ImageLayout::eShaderReadOnlyOptimal);
+		auto write     = vk::WriteDescriptorSet(set, BINDLESS_SAMPLED_IMAGE_BINDING, index, 1, vk::DescriptorType::eCombinedImageSampler, &imageInfo);
+		device.updateDescriptorSets(1, &write, 0, nullptr);
+	}
+
+	// the caller must make sure no frame in flight still references the slot
+	void releaseStorageBuffer(uint32_t index)
+	{
+		freeStorageBuffers.push_back(index);
+	}
+
+	void releaseSampledImage(uint32_t index)
+	{
+		freeSampledImages.push_back(index);
+	}
+
+	// slots in use
+	uint32_t storageBufferCount() const
+	{
+		return nextStorageBuffer - static_cast<uint32_t>(freeStorageBuffers.size());
+	}
+
+	uint32_t sampledImageCount() const
+	{
+		return nextSampledImage - static_cast<uint32_t>(freeSampledImages.size());
+	}
+
+  private:
+	vk::Device         device;
+	vk::DescriptorPool pool;
+
+	uint32_t              storageBufferCapacity = 0;
+	uint32_t              sampledImageCapacity  = 0;
+	uint32_t              nextStorageBuffer     = 0;
+	uint32_t              nextSampledImage      = 0;
+	std::vector<uint32_t> freeStorageBuffers;
+	std::vector<uint32_t> freeSampledImages;
+
+	static uint32_t allocateSlot(std::vector<uint32_t> &freeSlots, uint32_t &next, uint32_t capacity)
+	{
+		if (!freeSlots.empty())
+		{
+			uint32_t index = freeSlots.back();
+			freeSlots.pop_back();
+			return index;
+		}
+
+		if (next >= capacity)
+		{
+			throw std::runtime_error("out of bindless descriptor slots!");
+		}
+
+		return next++;
+	}
+};
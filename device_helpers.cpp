@@ -1,3 +1,5 @@
+#pragma once
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <vulkan/vulkan_beta.h>
@@ -27,6 +29,8 @@ struct QueueFamilyIndices
 {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	std::optional<uint32_t> computeFamily;         // dedicated compute family if there is one, graphics otherwise
+	std::optional<uint32_t> transferFamily;        // dedicated transfer family if there is one, compute otherwise
 };
 
 struct SwapChainSupportDetails
@@ -41,11 +45,13 @@ struct CreateDeviceResult
 	vk::Device device;
 	vk::Queue  graphicsQueue;
 	vk::Queue  presentQueue;
+	vk::Queue  computeQueue;
+	vk::Queue  transferQueue;
 };
 
 class DeviceHelpers
 {
-  private:
+  public:
 	static bool areAllExtensionsSupported(vk::PhysicalDevice device)
 	{
 		auto availableExtensions = device.enumerateDeviceExtensionProperties();
@@ -62,86 +68,141 @@ class DeviceHelpers
 		return requiredExtensions.empty();
 	}
 
-  public:
-	static QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device,
-	                                            VkSurfaceKHR       surface)
+	static bool isExtensionSupported(vk::PhysicalDevice device, const char *name)
 	{
-		QueueFamilyIndices indices;
-		auto               queueFamilyProperties = device.getQueueFamilyProperties();
-
-		// get the first index into queueFamiliyProperties which supports graphics
-		auto   propertyIterator         = std::find_if(queueFamilyProperties.begin(),
-		                                               queueFamilyProperties.end(),
-		                                               [](vk::QueueFamilyProperties const &qfp) { return qfp.queueFlags & vk::QueueFlagBits::eGraphics; });
-		size_t graphicsQueueFamilyIndex = std::distance(queueFamilyProperties.begin(), propertyIterator);
-		indices.graphicsFamily          = graphicsQueueFamilyIndex;
-
-		vk::Bool32 surfaceSupport = device.getSurfaceSupportKHR(static_cast<uint32_t>(graphicsQueueFamilyIndex), surface);
-
-		if (surfaceSupport)
+		for (auto &ext : device.enumerateDeviceExtensionProperties())
 		{
-			indices.presentFamily = graphicsQueueFamilyIndex;
-			return indices;
+			if (std::string(ext.extensionName.data()) == name)
+			{
+				return true;
+			}
 		}
-		else
+		return false;
+	}
+
+	// descriptor indexing features used by the global bindless descriptor set
+	static bool areBindlessFeaturesSupported(vk::PhysicalDevice device)
+	{
+		if (device.getProperties().apiVersion < VK_API_VERSION_1_2)
 		{
-			throw std::runtime_error("Can not find queue with graphics and presentation support");
+			return false;
 		}
+
+		auto  features   = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+		auto &features10 = features.get<vk::PhysicalDeviceFeatures2>().features;
+		auto &features12 = features.get<vk::PhysicalDeviceVulkan12Features>();
+
+		// shaders index the arrays with push constants, and per instance with nonuniformEXT
+		return features10.shaderStorageBufferArrayDynamicIndexing &&
+		       features10.shaderSampledImageArrayDynamicIndexing &&
+		       features12.shaderSampledImageArrayNonUniformIndexing &&
+		       features12.runtimeDescriptorArray &&
+		       features12.descriptorBindingPartiallyBound &&
+		       features12.descriptorBindingStorageBufferUpdateAfterBind &&
+		       features12.descriptorBindingSampledImageUpdateAfterBind &&
+		       features12.descriptorBindingUpdateUnusedWhilePending;
 	}
 
-	static std::tuple<bool, std::string> isDeviceSuitable(
-	    vk::PhysicalDevice device, VkSurfaceKHR surface)
+	// compute culling compacts draws and needs the gpu to read the draw count,
+	// each draw finds its object through a non-zero firstInstance
+	static bool isGpuCullingSupported(vk::PhysicalDevice device)
 	{
-		auto deviceProperties = device.getProperties();
-		auto deviceFeatures   = device.getFeatures();
+		auto  features   = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+		auto &features10 = features.get<vk::PhysicalDeviceFeatures2>().features;
+		auto &features12 = features.get<vk::PhysicalDeviceVulkan12Features>();
 
-		QueueFamilyIndices      indices          = findQueueFamilies(device, surface);
-		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device, surface);
+		return features12.drawIndirectCount && features10.multiDrawIndirect && features10.drawIndirectFirstInstance;
+	}
 
-		bool exntesionsSupported  = areAllExtensionsSupported(device);
-		bool swapChainSupportFine = false;
-		// extensions check must be before swapchain check
-		if (exntesionsSupported)
+	// every barrier is recorded with synchronization2
+	static bool isSynchronization2Supported(vk::PhysicalDevice device)
+	{
+		if (device.getProperties().apiVersion < VK_API_VERSION_1_3)
 		{
-			swapChainSupportFine = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
+			return false;
 		}
 
-		// originally there was deviceFeatures.geometryShader check, but it is
-		// not available in MacOS
-		bool isSuitable = swapChainSupportFine;
+		auto  features   = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+		auto &features13 = features.get<vk::PhysicalDeviceVulkan13Features>();
 
-		auto name   = std::string(deviceProperties.deviceName.data());
-		auto result = std::tuple(isSuitable, name);
+		return features13.synchronization2;
+	}
 
-		return result;
+	// dynamic rendering replaces render passes and framebuffers, its layout
+	// transitions are recorded with synchronization2 barriers
+	static bool isDynamicRenderingSupported(vk::PhysicalDevice device)
+	{
+		if (device.getProperties().apiVersion < VK_API_VERSION_1_3)
+		{
+			return false;
+		}
+
+		auto  features   = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan13Features>();
+		auto &features13 = features.get<vk::PhysicalDeviceVulkan13Features>();
+
+		return features13.dynamicRendering && features13.synchronization2;
 	}
 
-	static VkPhysicalDevice pickPhysicalDevice(vk::Instance instance,
-	                                           VkSurfaceKHR surface)
+	static QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device,
+	                                            VkSurfaceKHR       surface)
 	{
-		auto devices = instance.enumeratePhysicalDevices();
+		QueueFamilyIndices indices;
+		auto               queueFamilyProperties = device.getQueueFamilyProperties();
 
-		if (devices.size() == 0)
+		auto findFamily = [&queueFamilyProperties](vk::QueueFlags required, vk::QueueFlags excluded) -> std::optional<uint32_t> {
+			for (uint32_t i = 0; i < queueFamilyProperties.size(); i++)
+			{
+				auto flags = queueFamilyProperties[i].queueFlags;
+				if ((flags & required) == required && !(flags & excluded))
+				{
+					return i;
+				}
+			}
+			return std::nullopt;
+		};
+
+		indices.graphicsFamily = findFamily(vk::QueueFlagBits::eGraphics, {});
+		if (!indices.graphicsFamily.has_value())
 		{
-			throw std::runtime_error(
-			    "failed to find GPUs with Vulkan support!");
+			throw std::runtime_error("Can not find queue with graphics support");
 		}
 
-		for (const auto &device : devices)
+		// presenting from the graphics family avoids sharing swapchain images between families
+		if (device.getSurfaceSupportKHR(indices.graphicsFamily.value(), surface))
 		{
-			auto result     = isDeviceSuitable(device, surface);
-			auto isSuitable = std::get<0>(result);
-			auto name       = std::get<1>(result);
-
-			if (isSuitable)
+			indices.presentFamily = indices.graphicsFamily;
+		}
+		else
+		{
+			for (uint32_t i = 0; i < queueFamilyProperties.size(); i++)
 			{
-				std::cout << std::string("Going to use ") + name +
-				                 std::string(" card\n");
-				return device;
+				if (device.getSurfaceSupportKHR(i, surface))
+				{
+					indices.presentFamily = i;
+					break;
+				}
 			}
 		}
 
-		throw std::runtime_error("failed to find a suitable GPU!");
+		if (!indices.presentFamily.has_value())
+		{
+			throw std::runtime_error("Can not find queue with presentation support");
+		}
+
+		// families without graphics run next to rasterization instead of behind it
+		indices.computeFamily = findFamily(vk::QueueFlagBits::eCompute, vk::QueueFlagBits::eGraphics);
+		if (!indices.computeFamily.has_value())
+		{
+			indices.computeFamily = indices.graphicsFamily;
+		}
+
+		indices.transferFamily = findFamily(vk::QueueFlagBits::eTransfer, vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute);
+		if (!indices.transferFamily.has_value())
+		{
+			indices.transferFamily = indices.computeFamily;
+		}
+
+		return indices;
 	}
 
 	static CreateDeviceResult createLogicalDevice(
@@ -151,7 +212,10 @@ class DeviceHelpers
 	    QueueFamilyIndices        indices)
 	{
 		std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-		std::set<uint32_t>                     uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+		std::set<uint32_t>                     uniqueQueueFamilies = {indices.graphicsFamily.value(),
+		                                                              indices.presentFamily.value(),
+		                                                              indices.computeFamily.value(),
+		                                                              indices.transferFamily.value()};
 
 		float queuePriority = 1.0f;
 		for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -172,6 +236,42 @@ class DeviceHelpers
 			deviceExtensions.push_back(VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME);
 		}
 
+		// heap budgets for geometry streaming, heap sizes are used without it
+		if (isExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+		{
+			deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+		}
+
+		auto  supportedFeatures   = physicalDevice.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+		auto &supportedFeatures12 = supportedFeatures.get<vk::PhysicalDeviceVulkan12Features>();
+
+		auto features12                                          = vk::PhysicalDeviceVulkan12Features();
+		features12.runtimeDescriptorArray                        = true;
+		features12.descriptorBindingPartiallyBound               = true;
+		features12.descriptorBindingStorageBufferUpdateAfterBind = true;
+		features12.descriptorBindingSampledImageUpdateAfterBind  = true;
+		features12.descriptorBindingUpdateUnusedWhilePending     = true;
+		features12.shaderSampledImageArrayNonUniformIndexing     = true;        // lets a single draw pick a different texture per instance
+		features12.drawIndirectCount                             = supportedFeatures12.drawIndirectCount;
+
+		auto features13             = vk::PhysicalDeviceVulkan13Features();
+		features13.synchronization2 = true;
+		features13.dynamicRendering = isDynamicRenderingSupported(physicalDevice);
+		features12.pNext            = &features13;
+
+		auto &supportedFeatures10 = supportedFeatures.get<vk::PhysicalDeviceFeatures2>().features;
+
+		auto features2                                             = vk::PhysicalDeviceFeatures2();
+		features2.features.multiDrawIndirect                       = supportedFeatures10.multiDrawIndirect;
+		features2.features.drawIndirectFirstInstance               = supportedFeatures10.drawIndirectFirstInstance;
+		features2.features.shaderStorageBufferArrayDynamicIndexing = true;
+		features2.features.shaderSampledImageArrayDynamicIndexing  = true;
+		// texture formats and filtering are picked per file from what is enabled here
+		features2.features.samplerAnisotropy          = supportedFeatures10.samplerAnisotropy;
+		features2.features.textureCompressionBC       = supportedFeatures10.textureCompressionBC;
+		features2.features.textureCompressionASTC_LDR = supportedFeatures10.textureCompressionASTC_LDR;
+		features2.pNext                               = &features12;
+
 		auto deviceCreateInfo = vk::DeviceCreateInfo(
 		    {},
 		    static_cast<uint32_t>(queueCreateInfos.size()),
@@ -179,20 +279,29 @@ class DeviceHelpers
 		    static_cast<uint32_t>(validationLayers.size()),
 		    validationLayers.data(),
 		    static_cast<uint32_t>(deviceExtensions.size()),
-		    deviceExtensions.data());
+		    deviceExtensions.data(),
+		    nullptr,        // features are passed through features2
+		    &features2);
 
 		auto device = physicalDevice.createDevice(deviceCreateInfo);
 
 		vk::Queue graphicsQueue;
 		vk::Queue presentQueue;
+		vk::Queue computeQueue;
+		vk::Queue transferQueue;
 
+		// families that fall back to the graphics family share its only queue
 		graphicsQueue = device.getQueue(indices.graphicsFamily.value(), 0);
 		presentQueue  = device.getQueue(indices.presentFamily.value(), 0);
+		computeQueue  = device.getQueue(indices.computeFamily.value(), 0);
+		transferQueue = device.getQueue(indices.transferFamily.value(), 0);
 
 		CreateDeviceResult result;
 		result.device        = device;
 		result.graphicsQueue = graphicsQueue;
 		result.presentQueue  = presentQueue;
+		result.computeQueue  = computeQueue;
+		result.transferQueue = transferQueue;
 
 		return result;
 	}
@@ -229,8 +338,14 @@ class DeviceHelpers
 	}
 
 	// how we are going to show images from presentation queue.
-	static vk::PresentModeKHR chooseSwapPresentMode(const std::vector<vk::PresentModeKHR> &availablePresentModes)
+	// uncapped prefers tearing over waiting, for benchmarks and replays
+	static vk::PresentModeKHR chooseSwapPresentMode(const std::vector<vk::PresentModeKHR> &availablePresentModes, bool uncapped = false)
 	{
+		if (uncapped && std::find(availablePresentModes.begin(), availablePresentModes.end(), vk::PresentModeKHR::eImmediate) != availablePresentModes.end())
+		{
+			return vk::PresentModeKHR::eImmediate;
+		}
+
 		for (const auto &availablePresentMode : availablePresentModes)
 		{
 			// the best one
@@ -245,7 +360,8 @@ class DeviceHelpers
 	}
 
 	// resolution our images in the swap chain
-	static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities, GLFWwindow *window)
+	// width and height are the framebuffer size of the window
+	static VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities, uint32_t width, uint32_t height)
 	{
 		if (capabilities.currentExtent.width != std::numeric_limits<uint32_t>::max())
 		{
@@ -253,12 +369,7 @@ class DeviceHelpers
 		}
 		else
 		{
-			int width, height;
-			glfwGetFramebufferSize(window, &width, &height);
-
-			VkExtent2D actualExtent = {
-			    static_cast<uint32_t>(width),
-			    static_cast<uint32_t>(height)};
+			VkExtent2D actualExtent = {width, height};
 
 			actualExtent.width  = std::clamp(actualExtent.width, capabilities.minImageExtent.width, capabilities.maxImageExtent.width);
 			actualExtent.height = std::clamp(actualExtent.height, capabilities.minImageExtent.height, capabilities.maxImageExtent.height);
@@ -267,6 +378,42 @@ class DeviceHelpers
 		}
 	}
 
+	static bool hasMemoryType(vk::PhysicalDevice physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties)
+	{
+		auto memProperties = physicalDevice.getMemoryProperties();
+
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		{
+			if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// highest msaa level usable for color attachments, capped at 8x
+	static vk::SampleCountFlagBits getMaxUsableSampleCount(vk::PhysicalDevice physicalDevice)
+	{
+		auto counts = physicalDevice.getProperties().limits.framebufferColorSampleCounts;
+
+		if (counts & vk::SampleCountFlagBits::e8)
+		{
+			return vk::SampleCountFlagBits::e8;
+		}
+		if (counts & vk::SampleCountFlagBits::e4)
+		{
+			return vk::SampleCountFlagBits::e4;
+		}
+		if (counts & vk::SampleCountFlagBits::e2)
+		{
+			return vk::SampleCountFlagBits::e2;
+		}
+
+		return vk::SampleCountFlagBits::e1;
+	}
+
 	static uint32_t findMemoryType(vk::PhysicalDevice physicalDevice, uint32_t typeFilter, vk::MemoryPropertyFlags properties)
 	{
 		auto memProperties = physicalDevice.getMemoryProperties();
@@ -0,0 +1,351 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "device_helpers.cpp"
+
+// surface independent capabilities survive restarts in this file
+const char *DEVICE_CACHE_FILE = "device_cache.txt";
+
+// first token of every cache line, bump it when the line format or one of
+// the DeviceHelpers checks behind a capability changes
+const char *DEVICE_CACHE_VERSION = "v2";
+
+// set to a device name (or part of it) or its uuid to skip scoring
+const char *DEVICE_OVERRIDE_ENV = "THE_GAME_GPU";
+
+// everything device selection and the renderer need to know about a gpu
+// that does not depend on the surface
+struct DeviceCapabilities
+{
+	std::string             name;
+	std::string             uuid;        // hex encoded deviceUUID
+	uint32_t                driverVersion = 0;
+	uint32_t                apiVersion    = 0;
+	vk::PhysicalDeviceType  type          = vk::PhysicalDeviceType::eOther;
+	uint64_t                deviceLocalMemory;
+	uint32_t                maxImageDimension2D;
+	vk::SampleCountFlagBits maxSampleCount;
+	bool                    extensionsSupported;
+	bool                    bindless;
+	bool                    dynamicRendering;
+	bool                    gpuCulling;
+	bool                    dedicatedCompute;
+	bool                    dedicatedTransfer;
+};
+
+class DeviceSelector
+{
+  public:
+	static vk::PhysicalDevice pickPhysicalDevice(vk::Instance instance, VkSurfaceKHR surface)
+	{
+		auto devices = instance.enumeratePhysicalDevices();
+
+		if (devices.size() == 0)
+		{
+			throw std::runtime_error(
+			    "failed to find GPUs with Vulkan support!");
+		}
+
+		auto diskCache = loadDiskCache();
+
+		std::vector<std::pair<vk::PhysicalDevice, int64_t>> candidates;
+		for (const auto &device : devices)
+		{
+			auto &caps = capabilities(device, diskCache);
+
+			bool suitable = caps.extensionsSupported && caps.bindless && DeviceHelpers::isSynchronization2Supported(device) && isPresentable(device, surface);
+			auto score    = suitable ? scoreDevice(caps) : -1;
+
+			std::cout << std::string("Found ") + caps.name + " (" + caps.uuid + "), score " + std::to_string(score) + "\n";
+
+			if (suitable)
+			{
+				candidates.push_back({device, score});
+			}
+		}
+
+		if (diskCache.changed)
+		{
+			saveDiskCache(diskCache);
+		}
+
+		if (candidates.empty())
+		{
+			throw std::runtime_error("failed to find a suitable GPU!");
+		}
+
+		auto best   = std::max_element(candidates.begin(), candidates.end(),
+		                               [](const auto &a, const auto &b) { return a.second < b.second; });
+		auto chosen = best->first;
+
+		auto overrideDevice = findOverride(candidates);
+		if (overrideDevice)
+		{
+			chosen = overrideDevice;
+		}
+
+		std::cout << std::string("Going to use ") + capabilities(chosen).name +
+		                 std::string(" card\n");
+		return chosen;
+	}
+
+	// only valid for devices seen by pickPhysicalDevice
+	static const DeviceCapabilities &capabilities(vk::PhysicalDevice device)
+	{
+		return capabilityCache.at(device);
+	}
+
+	// Formats and present modes do not change for a surface, so they are
+	// queried once. Surface capabilities carry the current extent and are
+	// refreshed on every call.
+	static SwapChainSupportDetails swapChainSupport(vk::PhysicalDevice device, VkSurfaceKHR surface)
+	{
+		auto key    = std::make_pair(static_cast<VkPhysicalDevice>(device), surface);
+		auto cached = swapChainCache.find(key);
+		if (cached == swapChainCache.end())
+		{
+			cached = swapChainCache.emplace(key, DeviceHelpers::querySwapChainSupport(device, surface)).first;
+		}
+		else
+		{
+			cached->second.capabilities = device.getSurfaceCapabilitiesKHR(surface);
+		}
+
+		return cached->second;
+	}
+
+	static int64_t scoreDevice(const DeviceCapabilities &caps)
+	{
+		int64_t score = 0;
+
+		switch (caps.type)
+		{
+			case vk::PhysicalDeviceType::eDiscreteGpu:
+				score += 100000;
+				break;
+			case vk::PhysicalDeviceType::eIntegratedGpu:
+				score += 10000;
+				break;
+			case vk::PhysicalDeviceType::eVirtualGpu:
+				score += 1000;
+				break;
+			default:
+				break;
+		}
+
+		// one point per MiB of device local memory
+		score += static_cast<int64_t>(caps.deviceLocalMemory >> 20);
+
+		score += caps.dedicatedCompute ? 2000 : 0;
+		score += caps.dedicatedTransfer ? 1000 : 0;
+		score += caps.gpuCulling ? 2000 : 0;
+		score += caps.dynamicRendering ? 1000 : 0;
+		score += static_cast<int64_t>(caps.maxSampleCount) * 100;
+		score += caps.maxImageDimension2D / 1024;
+
+		return score;
+	}
+
+  private:
+	// the contents of DEVICE_CACHE_FILE, only written back when a device had to be queried
+	struct DiskCache
+	{
+		std::map<std::string, DeviceCapabilities> devices;
+		bool                                      changed = false;
+	};
+
+	static inline std::map<VkPhysicalDevice, DeviceCapabilities>                                capabilityCache;
+	static inline std::map<std::pair<VkPhysicalDevice, VkSurfaceKHR>, SwapChainSupportDetails> swapChainCache;
+
+	static const DeviceCapabilities &capabilities(vk::PhysicalDevice device, DiskCache &diskCache)
+	{
+		auto cached = capabilityCache.find(device);
+		if (cached != capabilityCache.end())
+		{
+			return cached->second;
+		}
+
+		auto  properties = device.getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+		auto &core       = properties.get<vk::PhysicalDeviceProperties2>().properties;
+		auto  uuid       = toHex(properties.get<vk::PhysicalDeviceIDProperties>().deviceUUID);
+
+		// a driver update can change what the device supports
+		auto fromDisk = diskCache.devices.find(uuid);
+		if (fromDisk == diskCache.devices.end() ||
+		    fromDisk->second.driverVersion != core.driverVersion ||
+		    fromDisk->second.apiVersion != core.apiVersion)
+		{
+			diskCache.devices[uuid] = queryCapabilities(device, core, uuid);
+			diskCache.changed       = true;
+			fromDisk                = diskCache.devices.find(uuid);
+		}
+
+		return capabilityCache.emplace(device, fromDisk->second).first->second;
+	}
+
+	static DeviceCapabilities queryCapabilities(vk::PhysicalDevice device, const vk::PhysicalDeviceProperties &properties, const std::string &uuid)
+	{
+		DeviceCapabilities caps;
+		caps.name                = std::string(properties.deviceName.data());
+		caps.uuid                = uuid;
+		caps.driverVersion       = properties.driverVersion;
+		caps.apiVersion          = properties.apiVersion;
+		caps.type                = properties.deviceType;
+		caps.maxImageDimension2D = properties.limits.maxImageDimension2D;
+		caps.maxSampleCount      = DeviceHelpers::getMaxUsableSampleCount(device);
+
+		auto memProperties     = device.getMemoryProperties();
+		caps.deviceLocalMemory = 0;
+		for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++)
+		{
+			if (memProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+			{
+				caps.deviceLocalMemory += memProperties.memoryHeaps[i].size;
+			}
+		}
+
+		caps.extensionsSupported = DeviceHelpers::areAllExtensionsSupported(device);
+		caps.bindless            = DeviceHelpers::areBindlessFeaturesSupported(device);
+		caps.dynamicRendering    = DeviceHelpers::isDynamicRenderingSupported(device);
+		caps.gpuCulling          = caps.bindless && DeviceHelpers::isGpuCullingSupported(device);
+
+		caps.dedicatedCompute  = false;
+		caps.dedicatedTransfer = false;
+		for (const auto &family : device.getQueueFamilyProperties())
+		{
+			if ((family.queueFlags & vk::QueueFlagBits::eCompute) && !(family.queueFlags & vk::QueueFlagBits::eGraphics))
+			{
+				caps.dedicatedCompute = true;
+			}
+			if ((family.queueFlags & vk::QueueFlagBits::eTransfer) && !(family.queueFlags & (vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute)))
+			{
+				caps.dedicatedTransfer = true;
+			}
+		}
+
+		return caps;
+	}
+
+	// needs a queue that can present and at least one format and present mode for the surface
+	static bool isPresentable(vk::PhysicalDevice device, VkSurfaceKHR surface)
+	{
+		try
+		{
+			DeviceHelpers::findQueueFamilies(device, surface);
+		}
+		catch (const std::runtime_error &)
+		{
+			return false;
+		}
+
+		if (!capabilities(device).extensionsSupported)
+		{
+			return false;
+		}
+
+		auto support = swapChainSupport(device, surface);
+		return !support.formats.empty() && !support.presentModes.empty();
+	}
+
+	static vk::PhysicalDevice findOverride(const std::vector<std::pair<vk::PhysicalDevice, int64_t>> &candidates)
+	{
+		const char *value = std::getenv(DEVICE_OVERRIDE_ENV);
+		if (value == nullptr || std::string(value).empty())
+		{
+			return nullptr;
+		}
+
+		auto wanted = toLower(value);
+		for (const auto &candidate : candidates)
+		{
+			auto &caps = capabilities(candidate.first);
+			if (toLower(caps.uuid) == wanted || toLower(caps.name).find(wanted) != std::string::npos)
+			{
+				return candidate.first;
+			}
+		}
+
+		std::cout << std::string(DEVICE_OVERRIDE_ENV) + "=" + value + " does not match a suitable device, ignoring it\n";
+		return nullptr;
+	}
+
+	static DiskCache loadDiskCache()
+	{
+		DiskCache     cache;
+		std::ifstream file(DEVICE_CACHE_FILE);
+
+		std::string line;
+		while (std::getline(file, line))
+		{
+			std::istringstream stream(line);
+			DeviceCapabilities caps;
+			std::string        version;
+			uint32_t           type, samples;
+
+			stream >> version >> caps.uuid >> caps.driverVersion >> caps.apiVersion >> type >>
+			    caps.deviceLocalMemory >> caps.maxImageDimension2D >> samples >>
+			    caps.extensionsSupported >> caps.bindless >> caps.dynamicRendering >> caps.gpuCulling >>
+			    caps.dedicatedCompute >> caps.dedicatedTransfer >> std::ws;
+
+			// damaged lines and ones written by another version are ignored, the device is queried again
+			if (!stream || version != DEVICE_CACHE_VERSION)
+			{
+				continue;
+			}
+
+			std::getline(stream, caps.name);
+
+			caps.type                = static_cast<vk::PhysicalDeviceType>(type);
+			caps.maxSampleCount      = static_cast<vk::SampleCountFlagBits>(samples);
+			cache.devices[caps.uuid] = caps;
+		}
+
+		return cache;
+	}
+
+	static void saveDiskCache(const DiskCache &cache)
+	{
+		std::ofstream file(DEVICE_CACHE_FILE, std::ios::trunc);
+
+		for (const auto &entry : cache.devices)
+		{
+			const auto &caps = entry.second;
+			file << DEVICE_CACHE_VERSION << ' ' << caps.uuid << ' ' << caps.driverVersion << ' ' << caps.apiVersion << ' '
+			     << static_cast<uint32_t>(caps.type) << ' ' << caps.deviceLocalMemory << ' '
+			     << caps.maxImageDimension2D << ' ' << static_cast<uint32_t>(caps.maxSampleCount) << ' '
+			     << caps.extensionsSupported << ' ' << caps.bindless << ' ' << caps.dynamicRendering << ' '
+			     << caps.gpuCulling << ' ' << caps.dedicatedCompute << ' ' << caps.dedicatedTransfer << ' '
+			     << caps.name << '\n';
+		}
+	}
+
+	template <typename T>
+	static std::string toHex(const T &bytes)
+	{
+		std::ostringstream stream;
+		for (auto byte : bytes)
+		{
+			stream << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint32_t>(byte);
+		}
+		return stream.str();
+	}
+
+	static std::string toLower(std::string value)
+	{
+		std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+		return value;
+	}
+};
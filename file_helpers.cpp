@@ -1,5 +1,10 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
 #include <fstream>
 #include <iostream>
+#include <string>
 #include <vector>
 
 static std::vector<char> readFile(const std::string &filename)
@@ -21,4 +26,13 @@ static std::vector<char> readFile(const std::string &filename)
 	std::cout << std::string("Loading of ") + filename + " is done\n";
 
 	return buffer;
+}
+
+// a module from a spir-v file, the caller destroys it
+static vk::ShaderModule loadShaderModule(vk::Device device, const std::string &filename)
+{
+	auto code             = readFile(filename);
+	auto convertedCode    = reinterpret_cast<const uint32_t *>(code.data());
+	auto createModuleInfo = vk::ShaderModuleCreateInfo({}, code.size(), convertedCode);
+	return device.createShaderModule(createModuleInfo);
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <mutex>
+#include <unordered_map>
+
+struct GpuMemoryCounters
+{
+	uint32_t                                        allocations      = 0;
+	uint64_t                                        totalAllocations = 0;        // since start, including freed ones
+	std::array<uint32_t, VK_MAX_MEMORY_TYPES>       typeAllocations  = {};
+	std::array<vk::DeviceSize, VK_MAX_MEMORY_TYPES> typeBytes        = {};
+};
+
+// Every device memory allocation of the renderer goes through here, so the
+// statistics know how many there are and how much each memory type holds;
+// Vulkan itself only reports usage per heap, and only with
+// VK_EXT_memory_budget. Allocations are rare, a mutex is enough.
+class GpuMemory
+{
+  public:
+	static vk::DeviceMemory allocate(vk::Device device, const vk::MemoryAllocateInfo &allocInfo)
+	{
+		auto memory = device.allocateMemory(allocInfo);
+
+		auto                       &state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		state.live[memory] = {allocInfo.memoryTypeIndex, allocInfo.allocationSize};
+		state.counters.allocations++;
+		state.counters.totalAllocations++;
+		state.counters.typeAllocations[allocInfo.memoryTypeIndex]++;
+		state.counters.typeBytes[allocInfo.memoryTypeIndex] += allocInfo.allocationSize;
+		return memory;
+	}
+
+	// like vkFreeMemory a null handle is ignored
+	static void free(vk::Device device, vk::DeviceMemory memory)
+	{
+		if (!memory)
+		{
+			return;
+		}
+		device.freeMemory(memory);
+
+		auto                       &state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		auto                        found = state.live.find(memory);
+		if (found == state.live.end())
+		{
+			return;
+		}
+		state.counters.allocations--;
+		state.counters.typeAllocations[found->second.type]--;
+		state.counters.typeBytes[found->second.type] -= found->second.size;
+		state.live.erase(found);
+	}
+
+	static GpuMemoryCounters counters()
+	{
+		auto                       &state = get();
+		std::lock_guard<std::mutex> lock(state.mutex);
+		return state.counters;
+	}
+
+  private:
+	struct Allocation
+	{
+		uint32_t       type;
+		vk::DeviceSize size;
+	};
+
+	struct State
+	{
+		std::mutex                                     mutex;
+		std::unordered_map<VkDeviceMemory, Allocation> live;
+		GpuMemoryCounters                              counters;
+	};
+
+	static State &get()
+	{
+		static State state;
+		return state;
+	}
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+#include "profiler.cpp"
+#include "submission_pool.cpp"
+
+// timestamp pairs per frame in flight
+const uint32_t GPU_PROFILE_MAX_ZONES = 32;
+
+// Measures command buffer sections with timestamp queries and adds them to
+// the profiler as a "gpu" track, so they line up with the cpu zones in the
+// exported trace. Results of a frame are read back when the frame's fence
+// has signaled, which is when its query range is reused.
+class GpuProfiler
+{
+  public:
+	// does nothing without THE_GAME_PROFILING or when the queue cannot write timestamps
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device, uint32_t queueFamily, SubmissionPool &submissions, uint32_t framesInFlight)
+	{
+#ifdef THE_GAME_PROFILING
+		this->device = device;
+
+		auto validBits = physicalDevice.getQueueFamilyProperties()[queueFamily].timestampValidBits;
+		if (validBits == 0)
+		{
+			return;
+		}
+
+		validMask       = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+		timestampPeriod = physicalDevice.getProperties().limits.timestampPeriod;
+
+		auto poolInfo       = vk::QueryPoolCreateInfo();
+		poolInfo.queryType  = vk::QueryType::eTimestamp;
+		poolInfo.queryCount = framesInFlight * GPU_PROFILE_MAX_ZONES * 2;
+		queryPool           = device.createQueryPool(poolInfo);
+
+		zoneNames.resize(framesInFlight);
+		track = &Profiler::createNanosecondTrack("gpu");
+
+		calibrate(submissions);
+#endif
+	}
+
+	void destroy()
+	{
+		if (queryPool)
+		{
+			device.destroyQueryPool(queryPool);
+		}
+	}
+
+	// records the reset of the frame's queries, after reading the results of its previous use
+	void beginFrame(vk::CommandBuffer commandBuffer, uint32_t frame)
+	{
+		if (!queryPool)
+		{
+			return;
+		}
+
+		collect(frame);
+
+		currentFrame = frame;
+		commandBuffer.resetQueryPool(queryPool, firstQuery(frame), GPU_PROFILE_MAX_ZONES * 2);
+	}
+
+	// returns the zone to pass to endZone, zones past the limit are not measured
+	uint32_t beginZone(vk::CommandBuffer commandBuffer, const char *name)
+	{
+		if (!queryPool || zoneNames[currentFrame].size() >= GPU_PROFILE_MAX_ZONES)
+		{
+			return GPU_PROFILE_MAX_ZONES;
+		}
+
+		uint32_t zone = static_cast<uint32_t>(zoneNames[currentFrame].size());
+		zoneNames[currentFrame].push_back(name);
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eTopOfPipe, queryPool, firstQuery(currentFrame) + zone * 2);
+		return zone;
+	}
+
+	void endZone(vk::CommandBuffer commandBuffer, uint32_t zone)
+	{
+		if (zone >= GPU_PROFILE_MAX_ZONES)
+		{
+			return;
+		}
+
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, firstQuery(currentFrame) + zone * 2 + 1);
+	}
+
+  private:
+	vk::Device                             device;
+	vk::QueryPool                          queryPool;
+	ProfileTrack                          *track = nullptr;
+	uint64_t                               validMask;
+	float                                  timestampPeriod;        // nanoseconds per tick
+	int64_t                                offsetNs = 0;           // steady clock minus gpu time
+	uint32_t                               currentFrame = 0;
+	std::vector<std::vector<const char *>> zoneNames;
+
+	uint32_t firstQuery(uint32_t frame) const
+	{
+		return frame * GPU_PROFILE_MAX_ZONES * 2;
+	}
+
+	void collect(uint32_t frame)
+	{
+		auto &names = zoneNames[frame];
+		if (names.empty())
+		{
+			return;
+		}
+
+		std::vector<uint64_t> timestamps(names.size() * 2);
+		auto                  result = vkGetQueryPoolResults(device, queryPool, firstQuery(frame), static_cast<uint32_t>(timestamps.size()),
+		                                                     timestamps.size() * sizeof(uint64_t), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+		// not ready only happens when the frame was never submitted, e.g. after a failed acquire
+		if (result == VK_SUCCESS)
+		{
+			for (size_t i = 0; i < names.size(); i++)
+			{
+				track->record(names[i], toNanoseconds(timestamps[i * 2]), toNanoseconds(timestamps[i * 2 + 1]));
+			}
+		}
+
+		names.clear();
+	}
+
+	uint64_t toNanoseconds(uint64_t timestamp) const
+	{
+		return static_cast<uint64_t>(static_cast<double>(timestamp & validMask) * timestampPeriod + offsetNs);
+	}
+
+	// Writes one timestamp and compares it with the steady clock once the
+	// submission has completed. The offset is late by the submission latency, which is
+	// small against frame times; VK_EXT_calibrated_timestamps would be exact.
+	void calibrate(SubmissionPool &submissions)
+	{
+		auto commandBuffer = submissions.beginCommands();
+		commandBuffer.resetQueryPool(queryPool, 0, 1);
+		commandBuffer.writeTimestamp(vk::PipelineStageFlagBits::eBottomOfPipe, queryPool, 0);
+		submissions.wait(submissions.submit(commandBuffer));
+
+		uint64_t cpuNs = Profiler::steadyNanoseconds();
+		uint64_t timestamp;
+		vkGetQueryPoolResults(device, queryPool, 0, 1, sizeof(timestamp), &timestamp, sizeof(timestamp), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+
+		offsetNs = static_cast<int64_t>(cpuNs) - static_cast<int64_t>(static_cast<double>(timestamp & validMask) * timestampPeriod);
+	}
+};
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+const uint32_t MAX_JOB_THREADS         = 64;
+const uint32_t MAX_JOBS_PER_THREAD     = 4096;        // ring of job slots, a slot is reused after this many allocations
+const uint32_t MAX_JOB_CONTINUATIONS   = 8;
+const uint32_t JOB_SPINS_BEFORE_SLEEP  = 64;
+const uint32_t JOB_DEQUE_CAPACITY      = MAX_JOBS_PER_THREAD;
+const size_t   JOB_FUNCTION_CAPACITY   = 64;          // bytes of captures stored inside a job
+
+// A callable stored inside the job slot, so creating a job never allocates.
+// Captures that do not fit in JOB_FUNCTION_CAPACITY bytes fail to compile,
+// larger state has to be captured by pointer.
+class JobFunction
+{
+  public:
+	JobFunction() = default;
+	~JobFunction()
+	{
+		reset();
+	}
+
+	JobFunction(const JobFunction &)            = delete;
+	JobFunction &operator=(const JobFunction &) = delete;
+
+	template <typename F>
+	void assign(F &&function)
+	{
+		using Callable = std::decay_t<F>;
+		static_assert(sizeof(Callable) <= JOB_FUNCTION_CAPACITY, "job captures too large, capture a pointer instead");
+		static_assert(alignof(Callable) <= alignof(std::max_align_t), "job captures are over-aligned");
+
+		reset();
+		new (storage) Callable(std::forward<F>(function));
+		invoke  = [](void *callable) { (*static_cast<Callable *>(callable))(); };
+		destroy = [](void *callable) { static_cast<Callable *>(callable)->~Callable(); };
+	}
+
+	void operator()()
+	{
+		invoke(storage);
+	}
+
+	// destroys the captures
+	void reset()
+	{
+		if (destroy != nullptr)
+		{
+			destroy(storage);
+		}
+		invoke  = nullptr;
+		destroy = nullptr;
+	}
+
+  private:
+	alignas(std::max_align_t) unsigned char storage[JOB_FUNCTION_CAPACITY];
+	void (*invoke)(void *callable)  = nullptr;
+	void (*destroy)(void *callable) = nullptr;
+};
+
+struct Job
+{
+	JobFunction function;
+	const char *name   = nullptr;
+	Job        *parent = nullptr;
+
+	// the job itself plus its unfinished children, 0 once the slot is free
+	std::atomic<int32_t> unfinished{0};
+
+	// run once this job and all its children are done
+	Job                  *continuations[MAX_JOB_CONTINUATIONS];
+	std::atomic<uint32_t> continuationCount{0};
+};
+
+// called around every job, used by the profiler
+struct JobTraceHooks
+{
+	void (*begin)(const Job &job) = nullptr;
+	void (*end)(const Job &job)   = nullptr;
+};
+
+// Chase-Lev work stealing deque with the memory orderings from Le et al.,
+// "Correct and Efficient Work-Stealing for Weak Memory Models". The owner
+// pushes and pops at the bottom, other threads steal from the top.
+class WorkStealingDeque
+{
+  public:
+	WorkStealingDeque() :
+	    buffer(new std::atomic<Job *>[JOB_DEQUE_CAPACITY])
+	{
+	}
+
+	bool push(Job *job)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		if (b - t >= static_cast<int64_t>(JOB_DEQUE_CAPACITY))
+		{
+			return false;
+		}
+
+		buffer[b & (JOB_DEQUE_CAPACITY - 1)].store(job, std::memory_order_relaxed);
+		bottom.store(b + 1, std::memory_order_release);
+		return true;
+	}
+
+	Job *pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+
+		if (t > b)
+		{
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		Job *job = buffer[b & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (t == b)
+		{
+			// last job, race against thieves for it
+			if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			{
+				job = nullptr;
+			}
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+
+		return job;
+	}
+
+	Job *steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+		{
+			return nullptr;
+		}
+
+		Job *job = buffer[t & (JOB_DEQUE_CAPACITY - 1)].load(std::memory_order_relaxed);
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+
+		return job;
+	}
+
+  private:
+	std::unique_ptr<std::atomic<Job *>[]> buffer;
+
+	alignas(64) std::atomic<int64_t> top{0};
+	alignas(64) std::atomic<int64_t> bottom{0};
+};
+
+// The one scheduler shared by the whole engine, sized to the cores of the
+// machine. Subsystems split their work into jobs instead of starting threads.
+//
+// A job finishes when its function and all of its children have run, then
+// its continuations are scheduled. Jobs live in a per-thread ring of slots;
+// when the ring wraps onto a job that is still unfinished, the allocating
+// thread helps run jobs until that slot is free. A job that is created but
+// never run therefore must not be left behind.
+class JobSystem
+{
+  public:
+	// The constructing thread is registered as well and helps while it waits.
+	// Background jobs only run on workers, so there is always at least one.
+	explicit JobSystem(uint32_t workerCount = defaultWorkerCount())
+	{
+		static_assert((JOB_DEQUE_CAPACITY & (JOB_DEQUE_CAPACITY - 1)) == 0, "deque capacity must be a power of two");
+
+		registerThread();
+
+		for (uint32_t i = 0; i < std::max(1u, workerCount); i++)
+		{
+			workers.emplace_back([this] {
+				registerThread();
+				workerLoop();
+			});
+		}
+	}
+
+	~JobSystem()
+	{
+		running.store(false, std::memory_order_seq_cst);
+		{
+			// taking the lock orders the store before any sleeping worker's check
+			std::lock_guard<std::mutex> lock(sleepMutex);
+		}
+		sleepCondition.notify_all();
+		for (auto &worker : workers)
+		{
+			worker.join();
+		}
+
+		for (auto &thread : threads)
+		{
+			delete thread.load(std::memory_order_relaxed);
+		}
+	}
+
+	// one core is left to the constructing thread, hardware_concurrency() may report 0
+	static uint32_t defaultWorkerCount()
+	{
+		auto cores = std::thread::hardware_concurrency();
+		return cores > 1 ? cores - 1 : 1;
+	}
+
+	JobSystem(const JobSystem &)            = delete;
+	JobSystem &operator=(const JobSystem &) = delete;
+
+	// other threads (render thread, loaders) call this before using the scheduler
+	void registerThread()
+	{
+		if (currentThread != nullptr)
+		{
+			return;
+		}
+
+		uint32_t index = threadCount.fetch_add(1);
+		if (index >= MAX_JOB_THREADS)
+		{
+			throw std::runtime_error("too many threads registered with the job system!");
+		}
+
+		currentThread = new ThreadData();
+		threads[index].store(currentThread, std::memory_order_release);
+	}
+
+	template <typename F>
+	Job *create(const char *name, F &&function)
+	{
+		return allocate(name, std::forward<F>(function), nullptr);
+	}
+
+	// the parent does not finish before the child
+	template <typename F>
+	Job *createChild(Job *parent, const char *name, F &&function)
+	{
+		parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+		return allocate(name, std::forward<F>(function), parent);
+	}
+
+	// must be called before the job is run
+	void addContinuation(Job *job, Job *continuation)
+	{
+		uint32_t index = job->continuationCount.fetch_add(1, std::memory_order_relaxed);
+		if (index >= MAX_JOB_CONTINUATIONS)
+		{
+			throw std::runtime_error("too many job continuations!");
+		}
+		job->continuations[index] = continuation;
+	}
+
+	void run(Job *job)
+	{
+		// a full deque means the thread is far ahead of the workers, run it inline
+		if (!currentThread->deque.push(job))
+		{
+			execute(job);
+			return;
+		}
+
+		wakeWorker();
+	}
+
+	// For blocking work like file reads. Only worker threads pick these up,
+	// so a thread helping out in wait() never stalls on them.
+	void runBackground(Job *job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(backgroundMutex);
+			backgroundJobs.push_back(job);
+		}
+		backgroundCount.fetch_add(1, std::memory_order_release);
+
+		wakeWorker();
+	}
+
+	bool isFinished(const Job *job) const
+	{
+		return job->unfinished.load(std::memory_order_acquire) == 0;
+	}
+
+	// executes other jobs instead of blocking
+	void wait(const Job *job)
+	{
+		while (!isFinished(job))
+		{
+			Job *next = findJob();
+			if (next != nullptr)
+			{
+				execute(next);
+			}
+			else
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// splits [0, count) into batches of batchSize and runs fn(begin, end) for each, returns when all are done
+	template <typename F>
+	void parallelFor(const char *name, size_t count, size_t batchSize, const F &fn)
+	{
+		Job *root = create(name, [] {});
+		for (size_t begin = 0; begin < count; begin += batchSize)
+		{
+			size_t end = std::min(count, begin + batchSize);
+			run(createChild(root, name, [&fn, begin, end] { fn(begin, end); }));
+		}
+		run(root);
+		wait(root);
+	}
+
+	void setTraceHooks(JobTraceHooks hooks)
+	{
+		traceHooks = hooks;
+	}
+
+	uint32_t threadCountForParallelism() const
+	{
+		return static_cast<uint32_t>(workers.size()) + 1;
+	}
+
+  private:
+	struct ThreadData
+	{
+		WorkStealingDeque       deque;
+		std::unique_ptr<Job[]>  jobs{new Job[MAX_JOBS_PER_THREAD]};
+		uint32_t                nextJob = 0;
+		std::minstd_rand        random{std::random_device()()};
+	};
+
+	static inline thread_local ThreadData *currentThread = nullptr;
+
+	// a slot stays null until its thread has finished registering
+	std::atomic<ThreadData *> threads[MAX_JOB_THREADS] = {};
+	std::atomic<uint32_t>     threadCount{0};
+	std::vector<std::thread>  workers;
+	std::atomic<bool>         running{true};
+	JobTraceHooks             traceHooks;
+
+	// bumped for every job made runnable, a worker only sleeps while it is unchanged
+	std::atomic<uint64_t>   workEpoch{0};
+	std::mutex              sleepMutex;
+	std::condition_variable sleepCondition;
+	std::atomic<uint32_t>   sleepingWorkers{0};
+
+	std::mutex            backgroundMutex;
+	std::deque<Job *>     backgroundJobs;
+	std::atomic<uint32_t> backgroundCount{0};
+
+	template <typename F>
+	Job *allocate(const char *name, F &&function, Job *parent)
+	{
+		Job *job = &currentThread->jobs[currentThread->nextJob++ & (MAX_JOBS_PER_THREAD - 1)];
+		if (!isFinished(job))
+		{
+			// the ring wrapped onto a job still in flight
+			wait(job);
+		}
+
+		job->function.assign(std::forward<F>(function));
+		job->name     = name;
+		job->parent   = parent;
+		job->unfinished.store(1, std::memory_order_relaxed);
+		job->continuationCount.store(0, std::memory_order_relaxed);
+		return job;
+	}
+
+	Job *findJob()
+	{
+		Job *job = currentThread->deque.pop();
+		if (job != nullptr)
+		{
+			return job;
+		}
+
+		uint32_t count = threadCount.load(std::memory_order_acquire);
+		uint32_t start = currentThread->random() % count;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			auto *victim = threads[(start + i) % count].load(std::memory_order_acquire);
+			if (victim == nullptr || victim == currentThread)
+			{
+				continue;
+			}
+
+			job = victim->deque.steal();
+			if (job != nullptr)
+			{
+				return job;
+			}
+		}
+
+		return nullptr;
+	}
+
+	Job *takeBackgroundJob()
+	{
+		if (backgroundCount.load(std::memory_order_acquire) == 0)
+		{
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(backgroundMutex);
+		if (backgroundJobs.empty())
+		{
+			return nullptr;
+		}
+
+		Job *job = backgroundJobs.front();
+		backgroundJobs.pop_front();
+		backgroundCount.fetch_sub(1, std::memory_order_relaxed);
+		return job;
+	}
+
+	void execute(Job *job)
+	{
+		if (traceHooks.begin != nullptr)
+		{
+			traceHooks.begin(*job);
+		}
+
+		job->function();
+
+		if (traceHooks.end != nullptr)
+		{
+			traceHooks.end(*job);
+		}
+
+		// before finishing, the slot may be reused right after
+		job->function.reset();
+		finish(job);
+	}
+
+	void finish(Job *job)
+	{
+		// read before the job can be considered finished and its slot reused
+		Job     *parent            = job->parent;
+		uint32_t continuationCount = job->continuationCount.load(std::memory_order_relaxed);
+		Job     *continuations[MAX_JOB_CONTINUATIONS];
+		std::copy(job->continuations, job->continuations + continuationCount, continuations);
+
+		if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		{
+			return;
+		}
+
+		for (uint32_t i = 0; i < continuationCount; i++)
+		{
+			run(continuations[i]);
+		}
+
+		if (parent != nullptr)
+		{
+			finish(parent);
+		}
+	}
+
+	void wakeWorker()
+	{
+		workEpoch.fetch_add(1, std::memory_order_seq_cst);
+		if (sleepingWorkers.load(std::memory_order_seq_cst) > 0)
+		{
+			// a worker between its check and the wait holds the lock
+			{
+				std::lock_guard<std::mutex> lock(sleepMutex);
+			}
+			sleepCondition.notify_one();
+		}
+	}
+
+	void workerLoop()
+	{
+		uint32_t idleSpins = 0;
+		while (running.load(std::memory_order_acquire))
+		{
+			// read before searching, a job made runnable after it changes the epoch
+			uint64_t epoch = workEpoch.load(std::memory_order_seq_cst);
+
+			Job *job = findJob();
+			if (job == nullptr)
+			{
+				job = takeBackgroundJob();
+			}
+
+			if (job != nullptr)
+			{
+				execute(job);
+				idleSpins = 0;
+				continue;
+			}
+
+			if (++idleSpins < JOB_SPINS_BEFORE_SLEEP)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(sleepMutex);
+			sleepingWorkers.fetch_add(1, std::memory_order_seq_cst);
+			sleepCondition.wait(lock, [&] {
+				return workEpoch.load(std::memory_order_seq_cst) != epoch || !running.load(std::memory_order_seq_cst);
+			});
+			sleepingWorkers.fetch_sub(1, std::memory_order_relaxed);
+			idleSpins = 0;
+		}
+	}
+};
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+#include "vertexData.cpp"
+
+const uint32_t MAX_LOD_LEVELS      = 4;
+const double   LOD_REDUCTION       = 0.5;          // each level keeps about this share of the full mesh's triangles per step
+const float    LOD_PIXEL_THRESHOLD = 1.0f;         // the coarsest level whose error stays under this many pixels is drawn
+const double   LOD_BOUNDARY_WEIGHT = 100.0;        // moving the outline costs this much more than moving inside the mesh
+const uint32_t MAX_LOD_MESHES      = 256;
+
+// must match LodLevel in cull.comp
+struct LodLevel
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float    error;        // largest deviation from the full mesh, in mesh units
+	uint32_t padding;
+};
+
+// all levels of a mesh, in the shared index buffer, must match MeshLods in cull.comp
+struct MeshLods
+{
+	LodLevel levels[MAX_LOD_LEVELS];
+	int32_t  vertexOffset;
+	uint32_t levelCount;
+	uint32_t padding[2];
+};
+
+// symmetric 4x4 error quadric (Garland and Heckbert), the squared distance to a set of planes
+struct Quadric
+{
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+	static Quadric fromPlane(double a, double b, double c, double d, double weight)
+	{
+		Quadric q;
+		q.a2 = a * a * weight;
+		q.ab = a * b * weight;
+		q.ac = a * c * weight;
+		q.ad = a * d * weight;
+		q.b2 = b * b * weight;
+		q.bc = b * c * weight;
+		q.bd = b * d * weight;
+		q.c2 = c * c * weight;
+		q.cd = c * d * weight;
+		q.d2 = d * d * weight;
+		return q;
+	}
+
+	void add(const Quadric &q)
+	{
+		a2 += q.a2;
+		ab += q.ab;
+		ac += q.ac;
+		ad += q.ad;
+		b2 += q.b2;
+		bc += q.bc;
+		bd += q.bd;
+		c2 += q.c2;
+		cd += q.cd;
+		d2 += q.d2;
+	}
+
+	double error(double x, double y, double z) const
+	{
+		return a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+		       b2 * y * y + 2 * bc * y * z + 2 * bd * y +
+		       c2 * z * z + 2 * cd * z + d2;
+	}
+};
+
+// Collapses edges into one of their end points, cheapest first, until at
+// most targetIndexCount indices are left or no collapse is possible
+// without flipping a triangle. Vertices are never moved or added, so every
+// level indexes the vertex buffer of the full mesh.
+//
+// The mesh is flat, so face planes would add no error. Instead a collapse
+// costs the squared distance the vertex moves plus its distance from the
+// planes through the boundary edges, which keeps the outline in place.
+// error returns the square root of the largest cost, in mesh units.
+static std::vector<uint32_t> simplifyMesh(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices, size_t targetIndexCount, float &error)
+{
+	struct Collapse
+	{
+		double   cost;
+		uint32_t from;
+		uint32_t to;
+		uint32_t fromVersion;
+		uint32_t toVersion;
+
+		bool operator>(const Collapse &other) const
+		{
+			return cost > other.cost;
+		}
+	};
+
+	size_t                             triangleCount = indices.size() / 3;
+	std::vector<uint32_t>              triangles     = indices;
+	std::vector<bool>                  alive(triangleCount, true);
+	std::vector<Quadric>               quadrics(vertices.size());
+	std::vector<std::vector<uint32_t>> vertexTriangles(vertices.size());
+	std::vector<bool>                  collapsed(vertices.size(), false);
+	std::vector<uint32_t>              versions(vertices.size(), 0);
+
+	auto x = [&](uint32_t v) { return static_cast<double>(vertices[v].pos.x); };
+	auto y = [&](uint32_t v) { return static_cast<double>(vertices[v].pos.y); };
+	auto area = [&](uint32_t a, uint32_t b, uint32_t c) {
+		return (x(b) - x(a)) * (y(c) - y(a)) - (x(c) - x(a)) * (y(b) - y(a));
+	};
+
+	// edges used by a single triangle are on the boundary
+	std::unordered_map<uint64_t, uint32_t> edgeUses;
+	auto                                   edgeKey = [](uint32_t a, uint32_t b) { return (uint64_t(std::min(a, b)) << 32) | std::max(a, b); };
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		for (uint32_t e = 0; e < 3; e++)
+		{
+			uint32_t v = triangles[t * 3 + e];
+			vertexTriangles[v].push_back(static_cast<uint32_t>(t));
+			edgeUses[edgeKey(v, triangles[t * 3 + (e + 1) % 3])]++;
+		}
+	}
+
+	for (const auto &edge : edgeUses)
+	{
+		if (edge.second != 1)
+		{
+			continue;
+		}
+
+		uint32_t a      = static_cast<uint32_t>(edge.first >> 32);
+		uint32_t b      = static_cast<uint32_t>(edge.first);
+		double   nx     = -(y(b) - y(a));
+		double   ny     = x(b) - x(a);
+		double   length = std::sqrt(nx * nx + ny * ny);
+		if (length == 0)
+		{
+			continue;
+		}
+
+		nx /= length;
+		ny /= length;
+		auto plane = Quadric::fromPlane(nx, ny, 0, -(nx * x(a) + ny * y(a)), LOD_BOUNDARY_WEIGHT);
+		quadrics[a].add(plane);
+		quadrics[b].add(plane);
+	}
+
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+
+	auto cost = [&](uint32_t from, uint32_t to) {
+		Quadric q = quadrics[from];
+		q.add(quadrics[to]);
+		double dx = x(from) - x(to);
+		double dy = y(from) - y(to);
+		return q.error(x(to), y(to), 0) + dx * dx + dy * dy;
+	};
+
+	auto pushEdges = [&](uint32_t v) {
+		for (uint32_t t : vertexTriangles[v])
+		{
+			if (!alive[t])
+			{
+				continue;
+			}
+			for (uint32_t e = 0; e < 3; e++)
+			{
+				uint32_t u = triangles[t * 3 + e];
+				if (u != v)
+				{
+					queue.push({cost(v, u), v, u, versions[v], versions[u]});
+					queue.push({cost(u, v), u, v, versions[u], versions[v]});
+				}
+			}
+		}
+	};
+
+	for (uint32_t v = 0; v < vertices.size(); v++)
+	{
+		pushEdges(v);
+	}
+
+	size_t indexCount = triangles.size();
+	double maxCost    = 0;
+
+	while (indexCount > targetIndexCount && !queue.empty())
+	{
+		auto collapse = queue.top();
+		queue.pop();
+
+		uint32_t from = collapse.from;
+		uint32_t to   = collapse.to;
+		if (collapsed[from] || collapsed[to] || versions[from] != collapse.fromVersion || versions[to] != collapse.toVersion)
+		{
+			continue;
+		}
+
+		// triangles that keep their area must keep their winding
+		bool flips = false;
+		for (uint32_t t : vertexTriangles[from])
+		{
+			uint32_t *tri = &triangles[t * 3];
+			if (!alive[t] || tri[0] == to || tri[1] == to || tri[2] == to)
+			{
+				continue;
+			}
+
+			double before = area(tri[0], tri[1], tri[2]);
+			double after  = area(tri[0] == from ? to : tri[0], tri[1] == from ? to : tri[1], tri[2] == from ? to : tri[2]);
+			if (before * after <= 0)
+			{
+				flips = true;
+				break;
+			}
+		}
+		if (flips)
+		{
+			continue;
+		}
+
+		for (uint32_t t : vertexTriangles[from])
+		{
+			uint32_t *tri = &triangles[t * 3];
+			if (!alive[t])
+			{
+				continue;
+			}
+
+			if (tri[0] == to || tri[1] == to || tri[2] == to)
+			{
+				alive[t] = false;
+				indexCount -= 3;
+				continue;
+			}
+
+			std::replace(tri, tri + 3, from, to);
+			vertexTriangles[to].push_back(t);
+		}
+
+		collapsed[from] = true;
+		quadrics[to].add(quadrics[from]);
+		versions[to]++;
+		maxCost = std::max(maxCost, collapse.cost);
+
+		pushEdges(to);
+	}
+
+	std::vector<uint32_t> result;
+	result.reserve(indexCount);
+	for (size_t t = 0; t < triangleCount; t++)
+	{
+		if (alive[t])
+		{
+			result.insert(result.end(), triangles.begin() + t * 3, triangles.begin() + t * 3 + 3);
+		}
+	}
+
+	error = static_cast<float>(std::sqrt(maxCost));
+	return result;
+}
+
+// for meshes too small to simplify, drawn at full detail at every size
+static MeshLods singleLod(uint32_t indexCount, int32_t vertexOffset = 0)
+{
+	MeshLods lods{};
+	lods.vertexOffset         = vertexOffset;
+	lods.levels[0].indexCount = indexCount;
+	lods.levelCount           = 1;
+	return lods;
+}
+
+// Level 0 is the mesh itself, level n targets LOD_REDUCTION^n of its
+// triangles. Every level is simplified from the full mesh, so its error is
+// measured against it. The levels are appended to indices.
+static MeshLods generateLods(const std::vector<Vertex> &vertices, const std::vector<uint32_t> &meshIndices, std::vector<uint32_t> &indices, int32_t vertexOffset = 0)
+{
+	MeshLods lods{};
+	lods.vertexOffset = vertexOffset;
+
+	auto  current = meshIndices;
+	float error   = 0;
+	for (uint32_t level = 0; level < MAX_LOD_LEVELS; level++)
+	{
+		if (level > 0)
+		{
+			size_t target     = static_cast<size_t>(meshIndices.size() / 3 * std::pow(LOD_REDUCTION, level)) * 3;
+			float  levelError = 0;
+			auto   simplified = simplifyMesh(vertices, meshIndices, target, levelError);
+
+			// not worth another level
+			if (simplified.empty() || simplified.size() > current.size() * 9 / 10)
+			{
+				break;
+			}
+
+			current = std::move(simplified);
+			error   = std::max(error, levelError);
+		}
+
+		lods.levels[level].firstIndex = static_cast<uint32_t>(indices.size());
+		lods.levels[level].indexCount = static_cast<uint32_t>(current.size());
+		lods.levels[level].error      = error;
+		lods.levelCount               = level + 1;
+		indices.insert(indices.end(), current.begin(), current.end());
+	}
+
+	return lods;
+}
+
+// the coarsest level whose error covers at most LOD_PIXEL_THRESHOLD pixels,
+// pixelsPerUnit is the projected size of one mesh unit at the object
+static uint32_t selectLod(const MeshLods &lods, float pixelsPerUnit)
+{
+	uint32_t level = 0;
+	while (level + 1 < lods.levelCount && lods.levels[level + 1].error * pixelsPerUnit <= LOD_PIXEL_THRESHOLD)
+	{
+		level++;
+	}
+	return level;
+}
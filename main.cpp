@@ -1,104 +1,420 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csignal>
 #include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <optional>
 #include <random>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
-#include "vulkan.cpp"
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "capture.cpp"
+#include "render_thread.cpp"
 
 #ifdef _WIN32
 #	include <corecrt_math_defines.h>
 #endif
 
+const char *TRACE_FILE_ENV = "THE_GAME_TRACE";
+
+const uint32_t WINDOW_WIDTH  = 800;
+const uint32_t WINDOW_HEIGHT = 600;
+
+struct Options
+{
+	std::string             capturePath;                // --capture <file> records every packet sent to the renderer
+	std::string             replayPath;                 // --replay <file> renders a capture as fast as possible
+	bool                    hidden = false;             // --hidden replays without showing the window
+	std::optional<uint64_t> seed;                       // --seed <n> makes the simulation repeatable
+	std::optional<uint32_t> chunks;                     // --chunks <n> lays out the first n streamed chunks in a grid, all of them by default
+	uint32_t                writeChunks = 0;            // --write-chunks <n> writes n generated chunks with their levels of detail and exits
+	uint32_t                sprites     = 0;            // --sprites <n> draws n sprites over the scene
+	bool                    stats       = false;        // --stats shows the statistics overlay from the start
+	uint32_t                msaa        = 4;            // --msaa <1|2|4|8> samples per pixel, capped by the device
+};
+
+// set by SIGUSR1, the main loop forwards it as a stats dump
+volatile std::sig_atomic_t statsDumpSignal = 0;
+
+void onStatsDumpSignal(int)
+{
+	statsDumpSignal = 1;
+}
+
+Options parseOptions(int argc, char **argv)
+{
+	Options options;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string argument = argv[i];
+		bool        hasValue = i + 1 < argc;
+
+		if (argument == "--capture" && hasValue)
+		{
+			options.capturePath = argv[++i];
+		}
+		else if (argument == "--replay" && hasValue)
+		{
+			options.replayPath = argv[++i];
+		}
+		else if (argument == "--seed" && hasValue)
+		{
+			options.seed = std::stoull(argv[++i]);
+		}
+		else if (argument == "--chunks" && hasValue)
+		{
+			options.chunks = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (argument == "--write-chunks" && hasValue)
+		{
+			options.writeChunks = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (argument == "--sprites" && hasValue)
+		{
+			options.sprites = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (argument == "--msaa" && hasValue)
+		{
+			options.msaa = static_cast<uint32_t>(std::stoul(argv[++i]));
+			if (options.msaa != 1 && options.msaa != 2 && options.msaa != 4 && options.msaa != 8)
+			{
+				throw std::runtime_error("--msaa takes 1, 2, 4 or 8!");
+			}
+		}
+		else if (argument == "--hidden")
+		{
+			options.hidden = true;
+		}
+		else if (argument == "--stats")
+		{
+			options.stats = true;
+		}
+		else
+		{
+			throw std::runtime_error("usage: the-game [--capture <file>] [--replay <file> [--hidden]] [--seed <n>] [--chunks <n>] [--write-chunks <n>] [--sprites <n>] [--msaa <1|2|4|8>] [--stats]");
+		}
+	}
+	return options;
+}
+
 class HelloTriangleApplication
 {
   public:
+	explicit HelloTriangleApplication(const Options &options) :
+	    options(options)
+	{
+	}
+
 	void run()
 	{
-		initWindow();
+		PROFILE_THREAD("main");
+#ifdef THE_GAME_PROFILING
+		jobs.setTraceHooks({[](const Job &job) { Profiler::pushZone(job.name); },
+		                    [](const Job &) { Profiler::popZone(); }});
+#endif
+
+		// offline content step, no window or device needed
+		if (options.writeChunks > 0)
+		{
+			writeGeneratedChunks(STREAMING_DIRECTORY, options.writeChunks);
+			std::cout << "Wrote " << options.writeChunks << " chunks to " << STREAMING_DIRECTORY << "\n";
+			return;
+		}
+
+		if (!options.replayPath.empty())
+		{
+			replay();
+			exportTrace();
+			return;
+		}
 
-		vulkan = new Vulkan(window);
+		std::random_device device;
+		uint64_t           seed = options.seed ? *options.seed : (uint64_t(device()) << 32) | device();
+		random.seed(seed);
+
+		initWindow(WINDOW_WIDTH, WINDOW_HEIGHT, true);
+		CleanupGuard guard{this};
+
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+
+		if (!options.capturePath.empty())
+		{
+			auto header = CaptureHeader{static_cast<uint32_t>(TICK_RATE), seed, static_cast<uint32_t>(width), static_cast<uint32_t>(height)};
+			capture     = std::make_unique<CaptureWriter>(options.capturePath, header);
+		}
+
+		renderer = std::make_unique<RenderThread>(window, jobs, width, height, static_cast<vk::SampleCountFlagBits>(options.msaa));
+		renderer->setStatsOverlay(options.stats);
+#ifdef SIGUSR1
+		std::signal(SIGUSR1, onStatsDumpSignal);
+#endif
+		submit(AddObjectPacket{glm::mat4(1.0f), glm::vec4(1.0f)});
+		uint32_t chunks = options.chunks ? *options.chunks : static_cast<uint32_t>(listChunkFiles(STREAMING_DIRECTORY).size());
+		if (chunks > 0)
+		{
+			submit(StreamChunksPacket{chunkGrid(chunks)});
+		}
+		if (options.sprites > 0)
+		{
+			submit(DrawSpritesPacket{spriteGrid(options.sprites, width, height)});
+		}
 		mainLoop();
-		cleanup();
+		guard.release();
+		exportTrace();
 	}
 
   private:
-	Vulkan     *vulkan;
-	GLFWwindow *window;
+	// Stops the renderer and destroys the window and glfw when it goes out of
+	// scope, so an error of the render thread rethrown by the main loop does
+	// not leave them running.
+	struct CleanupGuard
+	{
+		HelloTriangleApplication *application;
+
+		~CleanupGuard()
+		{
+			release();
+		}
+
+		void release()
+		{
+			if (application != nullptr)
+			{
+				application->cleanup();
+				application = nullptr;
+			}
+		}
+	};
+
+	Options options;
+
+	// shared by every subsystem, created first and destroyed last
+	JobSystem                     jobs;
+	std::unique_ptr<RenderThread> renderer;
+	GLFWwindow                   *window;
+
+	// simulation steps per second, independent of the frame rate
+	const int TICK_RATE = 60;
+
+	// every random number of the simulation comes from here, the seed is stored in captures
+	std::mt19937_64                random;
+	std::unique_ptr<CaptureWriter> capture;
+
+	void submit(RenderPacket packet)
+	{
+		if (capture)
+		{
+			capture->record(packet);
+		}
+		renderer->submit(std::move(packet));
+	}
 
+	// the main thread only polls input and simulates, it never waits on the gpu
 	void mainLoop()
 	{
-		auto state = vertices;
-		int  i     = 0;
+		using clock = std::chrono::steady_clock;
+
+		auto  tick     = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / TICK_RATE));
+		auto  nextTick = clock::now();
+		float angle    = 0;
+		int   i        = 0;
 		while (!glfwWindowShouldClose(window))
 		{
-			glfwPollEvents();
-			vulkan->drawFrame();
+			auto wait = std::chrono::duration<double>(nextTick - clock::now()).count();
+			glfwWaitEventsTimeout(std::max(wait, 0.0));
+			renderer->rethrowIfFailed();
+
+			if (statsDumpSignal)
+			{
+				statsDumpSignal = 0;
+				renderer->requestStatsDump();
+			}
+
+			if (clock::now() < nextTick)
+			{
+				continue;
+			}
+			nextTick += tick;
 			i++;
 
+			PROFILE_ZONE("simulation tick");
+
 			if (i % 2 == 0)
 			{
-				auto withColors = i % 10 == 0 ? getNewColors(state) : state;
-				auto rotated    = rotate(withColors);
-				state           = rotated;
-				vulkan->updateVertexBuffer(rotated);
+				// rotation is applied by the vertex shader, only the colors need an upload
+				angle += angleInRadians;
+				submit(SetTransformPacket{glm::rotate(glm::mat4(1.0f), angle, glm::vec3(0.0f, 0.0f, 1.0f))});
+			}
+
+			if (i % 10 == 0)
+			{
+				submit(UpdateVerticesPacket{getNewColors(vertices)});
+			}
+
+			if (capture)
+			{
+				capture->endTick();
 			}
 		}
 
-		vkDeviceWaitIdle(vulkan->device);
+		renderer->stop();
+		renderer->rethrowIfFailed();
 	}
 
 	std::vector<Vertex> getNewColors(std::vector<Vertex> v)
 	{
-		std::random_device                    rd;
-		std::mt19937                          mt(rd());
 		std::uniform_real_distribution<float> dist(0.0, 1.0);
 
 		std::vector<Vertex> result = {
-		    {v[0].pos, {dist(mt), dist(mt), dist(mt)}},
-		    {v[1].pos, {dist(mt), dist(mt), dist(mt)}},
-		    {v[2].pos, {dist(mt), dist(mt), dist(mt)}}};
+		    {v[0].pos, {dist(random), dist(random), dist(random)}, v[0].texCoord},
+		    {v[1].pos, {dist(random), dist(random), dist(random)}, v[1].texCoord},
+		    {v[2].pos, {dist(random), dist(random), dist(random)}, v[2].texCoord}};
 
 		return result;
 	}
 
-	float               angleInRadians = 1 * (M_PI / 180.0f);
-	std::vector<Vertex> rotate(std::vector<Vertex> v)
+	float angleInRadians = 1 * (M_PI / 180.0f);
+
+	// chunk i in a square grid covering the view
+	static std::vector<ChunkInstance> chunkGrid(uint32_t count)
 	{
-		// Calculate sine and cosine of the rotation angle
-		float cosTheta = std::cos(angleInRadians);
-		float sinTheta = std::sin(angleInRadians);
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+		float    size = 2.0f / side;
 
-		for (auto &vertex : v)
+		std::vector<ChunkInstance> instances(count);
+		for (uint32_t i = 0; i < count; i++)
 		{
-			// Apply the 2D rotation matrix to each vertex
-			float newX = vertex.pos[0] * cosTheta - vertex.pos[1] * sinTheta;
-			float newY = vertex.pos[0] * sinTheta + vertex.pos[1] * cosTheta;
+			auto position      = glm::vec3(-1.0f + size * (i % side + 0.5f), -1.0f + size * (i / side + 0.5f), 0.0f);
+			instances[i].model   = glm::scale(glm::translate(glm::mat4(1.0f), position), glm::vec3(size * 0.5f));
+			instances[i].tint    = glm::vec4(1.0f);
+			instances[i].chunk   = i;
+			instances[i].texture = i;        // untextured past the last texture file
+		}
+		return instances;
+	}
+
+	// count small translucent sprites covering the window, cycling through the texture files
+	std::vector<Sprite> spriteGrid(uint32_t count, int width, int height)
+	{
+		std::uniform_real_distribution<float> dist(0.0, 1.0);
 
-			// Update the vertex with the rotated coordinates
-			vertex.pos[0] = newX;
-			vertex.pos[1] = newY;
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<double>(count))));
+		auto     cell = glm::vec2(static_cast<float>(width) / side, static_cast<float>(height) / side);
+
+		std::vector<Sprite> sprites(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			auto &sprite    = sprites[i];
+			sprite.position = cell * glm::vec2(i % side, i / side);
+			sprite.size     = cell;
+			sprite.uvRect   = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			sprite.color    = glm::vec4(dist(random), dist(random), dist(random), 0.5f);
+			sprite.texture  = i % 4;
+			sprite.layer    = 0;
+			sprite.blend    = BlendMode::Alpha;
 		}
+		return sprites;
+	}
+
+	// Renders every captured tick once on this thread, without waiting for
+	// the tick rate, and prints the frame times. Replays of the same capture
+	// submit identical work, so their timings compare across builds.
+	void replay()
+	{
+		using clock = std::chrono::steady_clock;
+
+		CaptureReader reader(options.replayPath);
+		auto         &header = reader.getHeader();
+
+		initWindow(header.width, header.height, !options.hidden);
+		CleanupGuard guard{this};
+
+		int width, height;
+		glfwGetFramebufferSize(window, &width, &height);
+
+		auto vulkan = std::make_unique<Vulkan>(window, jobs, width, height, static_cast<vk::SampleCountFlagBits>(options.msaa), true);
+		vulkan->setStatsOverlay(options.stats);
 
-		return v;
+		std::vector<RenderPacket> packets;
+		std::vector<double>       frameTimes;
+		auto                      start = clock::now();
+		while (reader.nextTick(packets) && !glfwWindowShouldClose(window))
+		{
+			auto frameStart = clock::now();
+			glfwPollEvents();
+
+			for (const auto &packet : packets)
+			{
+				applyRenderPacket(vulkan.get(), packet);
+			}
+			vulkan->drawFrame();
+
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(clock::now() - frameStart).count());
+		}
+		vulkan->waitIdle();
+		auto total = std::chrono::duration<double>(clock::now() - start).count();
+
+		vulkan.reset();
+		guard.release();
+
+		printReplayTimings(frameTimes, total);
+	}
+
+	static void printReplayTimings(std::vector<double> frameTimes, double totalSeconds)
+	{
+		if (frameTimes.empty())
+		{
+			std::cout << "Capture has no frames\n";
+			return;
+		}
+
+		std::sort(frameTimes.begin(), frameTimes.end());
+		auto percentile = [&](double p) { return frameTimes[static_cast<size_t>(p * (frameTimes.size() - 1))]; };
+
+		std::cout << "Replayed " << frameTimes.size() << " frames in " << totalSeconds << " s ("
+		          << frameTimes.size() / totalSeconds << " fps)\n"
+		          << "frame ms: min " << frameTimes.front() << ", p50 " << percentile(0.5) << ", p95 " << percentile(0.95)
+		          << ", p99 " << percentile(0.99) << ", max " << frameTimes.back() << "\n";
 	}
 
 	void cleanup()
 	{
-		delete (vulkan);
+		if (capture)
+		{
+			std::cout << "Captured " << capture->tickCount() << " ticks to " << options.capturePath << "\n";
+			capture.reset();
+		}
+
+		renderer.reset();
 
 		glfwDestroyWindow(window);
 		glfwTerminate();
 	}
 
-	void initWindow()
+	// THE_GAME_TRACE=trace.json writes the profiler zones of the run on exit
+	void exportTrace()
 	{
-		const uint32_t WIDTH  = 800;
-		const uint32_t HEIGHT = 600;
+#ifdef THE_GAME_PROFILING
+		const char *path = std::getenv(TRACE_FILE_ENV);
+		if (path != nullptr && std::string(path) != "")
+		{
+			Profiler::exportChromeTrace(path);
+			std::cout << std::string("Trace written to ") + path + "\n";
+		}
+#endif
+	}
 
+	void initWindow(uint32_t width, uint32_t height, bool visible)
+	{
 		glfwInit();
 
 		// disable opengl
@@ -107,24 +423,51 @@ class HelloTriangleApplication
 		// disable window resizing
 		glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
-		window = glfwCreateWindow(WIDTH, HEIGHT, "The Game", nullptr, nullptr);
+		glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+
+		window = glfwCreateWindow(width, height, "The Game", nullptr, nullptr);
 		glfwSetWindowUserPointer(window, this);
 		glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+		glfwSetKeyCallback(window, keyCallback);
 	}
 
 	static void framebufferResizeCallback(GLFWwindow *window, int width, int height)
 	{
-		auto app                        = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
-		app->vulkan->framebufferResized = true;
+		auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+
+		// replays resize as the capture says, not as the window does
+		if (app->renderer == nullptr)
+		{
+			return;
+		}
+		app->submit(ResizePacket{static_cast<uint32_t>(width), static_cast<uint32_t>(height)});
+	}
+
+	// F3 toggles the statistics overlay, F12 dumps the statistics to a json file
+	static void keyCallback(GLFWwindow *window, int key, int, int action, int)
+	{
+		auto app = reinterpret_cast<HelloTriangleApplication *>(glfwGetWindowUserPointer(window));
+		if (app->renderer == nullptr || action != GLFW_PRESS)
+		{
+			return;
+		}
+
+		if (key == GLFW_KEY_F3)
+		{
+			app->renderer->setStatsOverlay(!app->renderer->isStatsOverlayVisible());
+		}
+		else if (key == GLFW_KEY_F12)
+		{
+			app->renderer->requestStatsDump();
+		}
 	}
 };
 
-int main()
+int main(int argc, char **argv)
 {
-	HelloTriangleApplication app;
-
 	try
 	{
+		HelloTriangleApplication app(parseOptions(argc, argv));
 		app.run();
 	}
 	catch (const std::exception &e)
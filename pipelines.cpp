@@ -0,0 +1,385 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "file_helpers.cpp"
+#include "jobs.cpp"
+#include "render_queue.cpp"
+#include "vertexData.cpp"
+
+// shader permutations, bit i of PipelineKey::features is the bool specialization constant with constant_id i
+const uint32_t MAX_PIPELINE_FEATURES          = 8;
+const uint8_t  PIPELINE_FEATURE_TEXTURED      = 1 << 0;        // shader.frag samples the object texture
+const uint8_t  PIPELINE_FEATURE_VERTEX_COLORS = 1 << 1;        // shader.vert applies the vertex colors
+
+enum class BlendMode : uint8_t
+{
+	Opaque,
+	Alpha,
+	Additive
+};
+
+// the pipeline state that varies between draws, everything else is shared by all variants
+struct PipelineKey
+{
+	vk::PrimitiveTopology topology = vk::PrimitiveTopology::eTriangleList;
+	vk::CullModeFlagBits  cullMode = vk::CullModeFlagBits::eBack;
+	BlendMode             blend    = BlendMode::Opaque;
+	uint8_t               features = PIPELINE_FEATURE_TEXTURED | PIPELINE_FEATURE_VERTEX_COLORS;
+
+	// 4 bits topology, 2 bits cull mode, 2 bits blend mode, 8 bits features
+	uint32_t packed() const
+	{
+		return static_cast<uint32_t>(topology) |
+		       static_cast<uint32_t>(cullMode) << 4 |
+		       static_cast<uint32_t>(blend) << 6 |
+		       static_cast<uint32_t>(features) << 8;
+	}
+};
+
+// the packed bits are dense in the low bits, mixing spreads them over the buckets
+struct PackedKeyHash
+{
+	size_t operator()(uint32_t key) const
+	{
+		key ^= key >> 16;
+		key *= 0x85ebca6b;
+		key ^= key >> 13;
+		key *= 0xc2b2ae35;
+		key ^= key >> 16;
+		return key;
+	}
+};
+
+// Graphics pipelines by state key. All variants share the shader modules and
+// the layout; shader permutations are specialization constants instead of
+// separate SPIR-V files. get() is a single hash probe. A variant that is not
+// built yet is compiled on a background job and get() returns a null
+// pipeline until it is ready, so a frame never waits for a compile. Variants
+// needed from the first frame on are built up front with prepare().
+class PipelineManager
+{
+  public:
+	// what every pipeline renders into, renderPass is null with dynamic rendering
+	struct Targets
+	{
+		vk::Format              colorFormat;
+		vk::SampleCountFlagBits samples;
+		vk::RenderPass          renderPass;
+	};
+
+	// without vertexInput the vertex shader pulls its vertices from buffers itself
+	void create(vk::Device device, JobSystem &jobs, vk::PipelineLayout layout, const Targets &targets,
+	            const std::string &vertexShader, const std::string &fragmentShader, bool vertexInput = true)
+	{
+		this->device         = device;
+		this->jobs           = &jobs;
+		this->layout         = layout;
+		this->targets        = targets;
+		this->vertexShader   = vertexShader;
+		this->fragmentShader = fragmentShader;
+		this->vertexInput    = vertexInput;
+
+		pipelineCache = device.createPipelineCache(vk::PipelineCacheCreateInfo());
+		loadShaders(vertexModule, fragmentModule);
+	}
+
+	void destroy()
+	{
+		waitForBuilds();
+
+		for (auto &pipeline : pipelines)
+		{
+			device.destroyPipeline(pipeline.second);
+		}
+		pipelines.clear();
+
+		device.destroyShaderModule(vertexModule);
+		device.destroyShaderModule(fragmentModule);
+		device.destroyPipelineCache(pipelineCache);
+	}
+
+	// builds the variant now if it does not exist yet
+	vk::Pipeline prepare(const PipelineKey &key)
+	{
+		uint32_t packed = key.packed();
+
+		auto found = pipelines.find(packed);
+		if (found != pipelines.end())
+		{
+			return found->second;
+		}
+
+		auto pipeline     = build(key, vertexModule, fragmentModule);
+		pipelines[packed] = pipeline;
+		return pipeline;
+	}
+
+	// null while the variant is being built, or until the next reload when building it failed
+	vk::Pipeline get(const PipelineKey &key)
+	{
+		uint32_t packed = key.packed();
+
+		auto found = pipelines.find(packed);
+		if (found != pipelines.end())
+		{
+			return found->second;
+		}
+
+		if (!failedBuilds.contains(packed) && pendingBuilds.insert(packed).second)
+		{
+			jobs->runBackground(jobs->create("build pipeline", [this, key] {
+				auto built = BuiltPipeline{key.packed(), nullptr};
+				try
+				{
+					built.pipeline = build(key, vertexModule, fragmentModule);
+				}
+				catch (const std::exception &e)
+				{
+					std::cout << "Failed to build pipeline variant " << key.packed() << ": " << e.what() << "\n";
+				}
+				finishedBuilds.push(built);
+			}));
+		}
+		return nullptr;
+	}
+
+	// adds the variants built since the last frame
+	void beginFrame()
+	{
+		BuiltPipeline built;
+		while (finishedBuilds.tryPop(built))
+		{
+			pendingBuilds.erase(built.key);
+			if (built.pipeline)
+			{
+				pipelines[built.key] = built.pipeline;
+			}
+			else
+			{
+				failedBuilds.insert(built.key);
+			}
+		}
+	}
+
+	// Rebuilds every variant with the shaders on disk. A variant that fails
+	// to build keeps its previous pipeline, the others are replaced; variants
+	// whose build failed before are tried again. Returns the replaced
+	// pipelines, frames in flight may still use them.
+	std::vector<vk::Pipeline> reload()
+	{
+		waitForBuilds();
+
+		vk::ShaderModule newVertexModule;
+		vk::ShaderModule newFragmentModule;
+		loadShaders(newVertexModule, newFragmentModule);
+
+		std::vector<vk::Pipeline> replaced;
+		for (auto &pipeline : pipelines)
+		{
+			try
+			{
+				auto rebuilt = build(unpack(pipeline.first), newVertexModule, newFragmentModule);
+				replaced.push_back(pipeline.second);
+				pipeline.second = rebuilt;
+			}
+			catch (const std::exception &e)
+			{
+				std::cout << "Failed to rebuild pipeline variant " << pipeline.first << ", keeping the previous one: " << e.what() << "\n";
+			}
+		}
+
+		auto failed = std::move(failedBuilds);
+		failedBuilds.clear();
+		for (uint32_t packed : failed)
+		{
+			try
+			{
+				pipelines[packed] = build(unpack(packed), newVertexModule, newFragmentModule);
+			}
+			catch (const std::exception &e)
+			{
+				std::cout << "Failed to build pipeline variant " << packed << ": " << e.what() << "\n";
+				failedBuilds.insert(packed);
+			}
+		}
+
+		// the pipelines do not need the modules they were built from
+		device.destroyShaderModule(vertexModule);
+		device.destroyShaderModule(fragmentModule);
+		vertexModule   = newVertexModule;
+		fragmentModule = newFragmentModule;
+
+		return replaced;
+	}
+
+	size_t pipelineCount() const
+	{
+		return pipelines.size();
+	}
+
+  private:
+	struct BuiltPipeline
+	{
+		uint32_t     key;
+		vk::Pipeline pipeline;
+	};
+
+	vk::Device         device;
+	JobSystem         *jobs;
+	vk::PipelineLayout layout;
+	Targets            targets;
+	std::string        vertexShader;
+	std::string        fragmentShader;
+	bool               vertexInput;
+	vk::ShaderModule   vertexModule;
+	vk::ShaderModule   fragmentModule;
+	vk::PipelineCache  pipelineCache;        // internally synchronized, shared by the background builds
+
+	std::unordered_map<uint32_t, vk::Pipeline, PackedKeyHash> pipelines;
+	std::unordered_set<uint32_t>                              pendingBuilds;
+	std::unordered_set<uint32_t>                              failedBuilds;        // retried by the next reload
+	MpscQueue<BuiltPipeline, 64>                              finishedBuilds;
+
+	static PipelineKey unpack(uint32_t packed)
+	{
+		auto key     = PipelineKey();
+		key.topology = static_cast<vk::PrimitiveTopology>(packed & 0xf);
+		key.cullMode = static_cast<vk::CullModeFlagBits>(packed >> 4 & 0x3);
+		key.blend    = static_cast<BlendMode>(packed >> 6 & 0x3);
+		key.features = static_cast<uint8_t>(packed >> 8);
+		return key;
+	}
+
+	void loadShaders(vk::ShaderModule &vertex, vk::ShaderModule &fragment)
+	{
+		vertex = loadShaderModule(device, vertexShader);
+		try
+		{
+			fragment = loadShaderModule(device, fragmentShader);
+		}
+		catch (...)
+		{
+			device.destroyShaderModule(vertex);
+			throw;
+		}
+	}
+
+	// the modules must stay alive until the background builds using them finished
+	void waitForBuilds()
+	{
+		while (!pendingBuilds.empty())
+		{
+			beginFrame();
+			std::this_thread::yield();
+		}
+	}
+
+	// safe to call from any thread
+	vk::Pipeline build(const PipelineKey &key, vk::ShaderModule vertex, vk::ShaderModule fragment) const
+	{
+		std::array<vk::SpecializationMapEntry, MAX_PIPELINE_FEATURES> entries;
+		std::array<vk::Bool32, MAX_PIPELINE_FEATURES>                 values;
+		for (uint32_t i = 0; i < MAX_PIPELINE_FEATURES; i++)
+		{
+			entries[i] = vk::SpecializationMapEntry(i, i * sizeof(vk::Bool32), sizeof(vk::Bool32));
+			values[i]  = (key.features >> i) & 1;
+		}
+
+		// constant ids a shader does not declare are ignored
+		auto specialization = vk::SpecializationInfo(MAX_PIPELINE_FEATURES, entries.data(), sizeof(values), values.data());
+
+		auto vertShaderStageInfo = vk::PipelineShaderStageCreateInfo(
+		    {}, vk::ShaderStageFlagBits::eVertex, vertex, "main", &specialization);
+
+		auto fragShaderStageInfo = vk::PipelineShaderStageCreateInfo(
+		    {}, vk::ShaderStageFlagBits::eFragment, fragment, "main", &specialization);
+
+		vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+		auto bindingDescription    = Vertex::getBindingDescription();
+		auto attributeDescriptions = Vertex::getAttributeDescriptions();
+
+		auto vertexInputInfo = vk::PipelineVertexInputStateCreateInfo();
+		if (vertexInput)
+		{
+			vertexInputInfo.vertexBindingDescriptionCount   = 1;
+			vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
+			vertexInputInfo.pVertexBindingDescriptions      = &bindingDescription;
+			vertexInputInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
+		}
+
+		auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo({}, key.topology, false);
+
+		std::vector<vk::DynamicState> dynamicStates = {
+		    vk::DynamicState::eViewport,
+		    vk::DynamicState::eScissor};
+
+		auto dynamicState = vk::PipelineDynamicStateCreateInfo({}, static_cast<uint32_t>(dynamicStates.size()), dynamicStates.data());
+
+		auto viewportState = vk::PipelineViewportStateCreateInfo({}, 1, {}, 1);
+
+		auto rasterizer        = vk::PipelineRasterizationStateCreateInfo();
+		rasterizer.polygonMode = vk::PolygonMode::eFill;
+		rasterizer.lineWidth   = 1.0f;
+		rasterizer.cullMode    = key.cullMode;
+		rasterizer.frontFace   = vk::FrontFace::eClockwise;
+
+		auto multisampling                 = vk::PipelineMultisampleStateCreateInfo();
+		multisampling.rasterizationSamples = targets.samples;
+
+		auto colorBlendAttachment           = vk::PipelineColorBlendAttachmentState();
+		colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR |
+		                                      vk::ColorComponentFlagBits::eG |
+		                                      vk::ColorComponentFlagBits::eB |
+		                                      vk::ColorComponentFlagBits::eA;
+
+		if (key.blend != BlendMode::Opaque)
+		{
+			colorBlendAttachment.blendEnable         = true;
+			colorBlendAttachment.srcColorBlendFactor = vk::BlendFactor::eSrcAlpha;
+			colorBlendAttachment.dstColorBlendFactor = key.blend == BlendMode::Additive ? vk::BlendFactor::eOne : vk::BlendFactor::eOneMinusSrcAlpha;
+			colorBlendAttachment.colorBlendOp        = vk::BlendOp::eAdd;
+			colorBlendAttachment.srcAlphaBlendFactor = vk::BlendFactor::eOne;
+			colorBlendAttachment.dstAlphaBlendFactor = vk::BlendFactor::eOneMinusSrcAlpha;
+			colorBlendAttachment.alphaBlendOp        = vk::BlendOp::eAdd;
+		}
+
+		auto colorBlending            = vk::PipelineColorBlendStateCreateInfo();
+		colorBlending.logicOp         = vk::LogicOp::eCopy;
+		colorBlending.attachmentCount = 1;
+		colorBlending.pAttachments    = &colorBlendAttachment;
+
+		// attachment formats are given up front instead of through a render pass
+		auto renderingInfo                    = vk::PipelineRenderingCreateInfo();
+		renderingInfo.colorAttachmentCount    = 1;
+		renderingInfo.pColorAttachmentFormats = &targets.colorFormat;
+
+		auto pipelineInfo                = vk::GraphicsPipelineCreateInfo();
+		pipelineInfo.pNext               = targets.renderPass ? nullptr : &renderingInfo;
+		pipelineInfo.stageCount          = 2;
+		pipelineInfo.pStages             = shaderStages;
+		pipelineInfo.pVertexInputState   = &vertexInputInfo;
+		pipelineInfo.pInputAssemblyState = &inputAssembly;
+		pipelineInfo.pViewportState      = &viewportState;
+		pipelineInfo.pRasterizationState = &rasterizer;
+		pipelineInfo.pMultisampleState   = &multisampling;
+		pipelineInfo.pColorBlendState    = &colorBlending;
+		pipelineInfo.pDynamicState       = &dynamicState;
+		pipelineInfo.layout              = layout;
+		pipelineInfo.renderPass          = targets.renderPass;
+		pipelineInfo.subpass             = 0;
+		pipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
+
+		return device.createGraphicsPipeline(pipelineCache, pipelineInfo).value;
+	}
+};
@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#endif
+
+// Scoped-zone profiler. Zones are recorded into a lock-free ring buffer
+// owned by the recording thread and exported as Chrome trace JSON, which
+// chrome://tracing and ui.perfetto.dev open. Building without
+// THE_GAME_PROFILING (cmake -DTHE_GAME_PROFILING=OFF) removes every zone.
+#ifdef THE_GAME_PROFILING
+#	define PROFILE_CONCAT_INNER(a, b) a##b
+#	define PROFILE_CONCAT(a, b)       PROFILE_CONCAT_INNER(a, b)
+#	define PROFILE_ZONE(name)         ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#	define PROFILE_THREAD(name)       Profiler::setThreadName(name)
+#else
+#	define PROFILE_ZONE(name)
+#	define PROFILE_THREAD(name)
+#endif
+
+// zones kept per thread, older ones are overwritten
+const uint32_t PROFILE_EVENTS_PER_THREAD = 1 << 16;
+const uint32_t PROFILE_MAX_DEPTH         = 64;
+
+// Written by the owning thread only. The fields are relaxed atomics so a
+// live export can read them without a data race; on x86 and arm64 these
+// are plain loads and stores.
+struct ProfileEvent
+{
+	std::atomic<const char *> name;
+	std::atomic<uint64_t>     start;
+	std::atomic<uint64_t>     end;
+};
+
+struct ProfileTrack
+{
+	std::string                     name;
+	uint32_t                        id;
+	bool                            nanoseconds;        // gpu tracks are converted before recording
+	std::unique_ptr<ProfileEvent[]> events{new ProfileEvent[PROFILE_EVENTS_PER_THREAD]};
+	std::atomic<uint64_t>           written{0};
+
+	// open zones of pushZone, only touched by the owning thread
+	const char *openNames[PROFILE_MAX_DEPTH];
+	uint64_t    openStarts[PROFILE_MAX_DEPTH];
+	uint32_t    depth = 0;
+
+	void record(const char *zone, uint64_t start, uint64_t end)
+	{
+		uint64_t index = written.load(std::memory_order_relaxed);
+		auto    &event = events[index & (PROFILE_EVENTS_PER_THREAD - 1)];
+		event.name.store(zone, std::memory_order_relaxed);
+		event.start.store(start, std::memory_order_relaxed);
+		event.end.store(end, std::memory_order_relaxed);
+		written.store(index + 1, std::memory_order_release);
+	}
+};
+
+class Profiler
+{
+  public:
+	// rdtsc where available, converted to nanoseconds only on export
+	static uint64_t now()
+	{
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return steadyNanoseconds();
+#endif
+	}
+
+	static uint64_t steadyNanoseconds()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static void setThreadName(const char *name)
+	{
+		auto                       &track = currentTrack();
+		std::lock_guard<std::mutex> lock(get().tracksMutex);
+		track.name = name;
+	}
+
+	static void record(const char *name, uint64_t start, uint64_t end)
+	{
+		currentTrack().record(name, start, end);
+	}
+
+	// for zones that do not fit a scope, like the job trace hooks
+	static void pushZone(const char *name)
+	{
+		auto &track = currentTrack();
+		if (track.depth < PROFILE_MAX_DEPTH)
+		{
+			track.openNames[track.depth]  = name;
+			track.openStarts[track.depth] = now();
+		}
+		track.depth++;
+	}
+
+	static void popZone()
+	{
+		auto &track = currentTrack();
+		track.depth--;
+		if (track.depth < PROFILE_MAX_DEPTH)
+		{
+			track.record(track.openNames[track.depth], track.openStarts[track.depth], now());
+		}
+	}
+
+	// a track that holds steady clock nanoseconds instead of ticks, written by a single thread
+	static ProfileTrack &createNanosecondTrack(const char *name)
+	{
+		return addTrack(name, true);
+	}
+
+	// Can run while other threads record. Events overwritten during the
+	// export are dropped instead of being written torn.
+	static void exportChromeTrace(const std::string &path)
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file)
+		{
+			throw std::runtime_error("failed to open trace file!");
+		}
+
+		auto &state = get();
+
+		// ticks per nanosecond, measured over the whole run
+		uint64_t nowTicks       = now();
+		uint64_t nowNs          = steadyNanoseconds();
+		double   ticksPerNs     = nowNs > state.startNs ? double(nowTicks - state.startTicks) / double(nowNs - state.startNs) : 1.0;
+		auto     toMicroseconds = [&](const ProfileTrack &track, uint64_t time) {
+			double ns = track.nanoseconds ? double(time) - double(state.startNs) : double(time - state.startTicks) / ticksPerNs;
+			return ns / 1000.0;
+		};
+
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+		bool first = true;
+
+		std::lock_guard<std::mutex> lock(state.tracksMutex);
+		for (auto &track : state.tracks)
+		{
+			file << (first ? "" : ",\n") << "{\"ph\":\"M\",\"pid\":1,\"tid\":" << track->id
+			     << ",\"name\":\"thread_name\",\"args\":{\"name\":\"" << escape(track->name) << "\"}}";
+			first = false;
+
+			uint64_t written = track->written.load(std::memory_order_acquire);
+			uint64_t begin   = written > PROFILE_EVENTS_PER_THREAD ? written - PROFILE_EVENTS_PER_THREAD : 0;
+
+			std::vector<std::pair<const char *, std::pair<uint64_t, uint64_t>>> copied;
+			for (uint64_t i = begin; i < written; i++)
+			{
+				auto &event = track->events[i & (PROFILE_EVENTS_PER_THREAD - 1)];
+				copied.push_back({event.name.load(std::memory_order_relaxed),
+				                  {event.start.load(std::memory_order_relaxed), event.end.load(std::memory_order_relaxed)}});
+			}
+
+			// anything the owner wrote meanwhile may have replaced the oldest copies
+			uint64_t after = track->written.load(std::memory_order_acquire);
+			uint64_t valid = after > PROFILE_EVENTS_PER_THREAD ? after - PROFILE_EVENTS_PER_THREAD : 0;
+
+			for (uint64_t i = std::max(begin, valid); i < written; i++)
+			{
+				auto  &event = copied[i - begin];
+				double start = toMicroseconds(*track, event.second.first);
+				double end   = toMicroseconds(*track, event.second.second);
+				file << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << track->id << ",\"name\":\"" << escape(event.first)
+				     << "\",\"ts\":" << std::to_string(start) << ",\"dur\":" << std::to_string(end - start) << "}";
+			}
+		}
+
+		file << "\n]}\n";
+	}
+
+  private:
+	struct State
+	{
+		uint64_t                                   startTicks = now();
+		uint64_t                                   startNs    = steadyNanoseconds();
+		std::mutex                                 tracksMutex;
+		std::vector<std::unique_ptr<ProfileTrack>> tracks;
+	};
+
+	static State &get()
+	{
+		static State state;
+		return state;
+	}
+
+	// registering takes a lock once per thread, recording never does
+	static ProfileTrack &currentTrack()
+	{
+		static thread_local ProfileTrack *track = nullptr;
+		if (track == nullptr)
+		{
+			track = &addTrack("", false);
+		}
+		return *track;
+	}
+
+	static ProfileTrack &addTrack(const std::string &name, bool nanoseconds)
+	{
+		auto                       &state = get();
+		std::lock_guard<std::mutex> lock(state.tracksMutex);
+		state.tracks.push_back(std::make_unique<ProfileTrack>());
+		auto &track       = *state.tracks.back();
+		track.id          = static_cast<uint32_t>(state.tracks.size());
+		track.name        = name.empty() ? "thread " + std::to_string(track.id) : name;
+		track.nanoseconds = nanoseconds;
+		return track;
+	}
+
+	static std::string escape(const std::string &text)
+	{
+		std::string result;
+		for (char c : text)
+		{
+			if (c == '"' || c == '\\')
+			{
+				result += '\\';
+			}
+			result += c;
+		}
+		return result;
+	}
+};
+
+class ProfileZone
+{
+  public:
+	explicit ProfileZone(const char *name) :
+	    name(name), start(Profiler::now())
+	{
+	}
+
+	~ProfileZone()
+	{
+		Profiler::record(name, start, Profiler::now());
+	}
+
+	ProfileZone(const ProfileZone &)            = delete;
+	ProfileZone &operator=(const ProfileZone &) = delete;
+
+  private:
+	const char *name;
+	uint64_t    start;
+};
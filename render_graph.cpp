@@ -0,0 +1,671 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "device_helpers.cpp"
+#include "gpu_memory.cpp"
+#include "profiler.cpp"
+
+// how a pass uses a resource, barriers and layout transitions are derived from it
+struct ResourceState
+{
+	vk::PipelineStageFlags2 stage;
+	vk::AccessFlags2        access;
+	vk::ImageLayout         layout = vk::ImageLayout::eUndefined;        // ignored for buffers
+};
+
+const ResourceState STATE_NONE             = {vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone};
+const ResourceState STATE_COLOR_ATTACHMENT = {vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eColorAttachmentWrite, vk::ImageLayout::eColorAttachmentOptimal};
+const ResourceState STATE_SAMPLED          = {vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead, vk::ImageLayout::eShaderReadOnlyOptimal};
+const ResourceState STATE_COMPUTE_WRITE    = {vk::PipelineStageFlagBits2::eComputeShader, vk::AccessFlagBits2::eShaderStorageWrite, vk::ImageLayout::eGeneral};
+const ResourceState STATE_INDIRECT_READ    = {vk::PipelineStageFlagBits2::eDrawIndirect, vk::AccessFlagBits2::eIndirectCommandRead};
+const ResourceState STATE_PRESENT          = {vk::PipelineStageFlagBits2::eBottomOfPipe, vk::AccessFlagBits2::eNone, vk::ImageLayout::ePresentSrcKHR};
+
+// the previous contents of the swapchain image are cleared, the acquire semaphore is waited on at this stage
+const ResourceState STATE_ACQUIRED = {vk::PipelineStageFlagBits2::eColorAttachmentOutput, vk::AccessFlagBits2::eNone, vk::ImageLayout::eUndefined};
+
+const vk::AccessFlags2 WRITE_ACCESS = vk::AccessFlagBits2::eShaderWrite |
+                                      vk::AccessFlagBits2::eShaderStorageWrite |
+                                      vk::AccessFlagBits2::eColorAttachmentWrite |
+                                      vk::AccessFlagBits2::eDepthStencilAttachmentWrite |
+                                      vk::AccessFlagBits2::eTransferWrite |
+                                      vk::AccessFlagBits2::eHostWrite |
+                                      vk::AccessFlagBits2::eMemoryWrite;
+
+// index of a resource in its graph
+using RenderResource = uint32_t;
+
+const uint32_t NO_PASS = UINT32_MAX;
+
+// an image the graph creates and owns, valid for the passes between its first and last use only
+struct TransientImageInfo
+{
+	vk::Format              format;
+	vk::Extent2D            extent;
+	vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1;
+	vk::ImageUsageFlags     usage;
+	vk::ImageAspectFlags    aspect = vk::ImageAspectFlagBits::eColor;
+};
+
+class RenderGraph;
+
+class RenderGraphPass
+{
+  public:
+	using Execute = std::function<void(vk::CommandBuffer, RenderGraph &)>;
+
+	struct Access
+	{
+		RenderResource resource;
+		ResourceState  state;
+		bool           reads;
+		bool           writes;
+	};
+
+	std::string         name;
+	Execute             execute;
+	std::vector<Access> accesses;
+	bool                keep = false;
+	bool                live = false;
+
+	RenderGraphPass &read(RenderResource resource, const ResourceState &state)
+	{
+		return use(resource, state, true, false);
+	}
+
+	RenderGraphPass &write(RenderResource resource, const ResourceState &state)
+	{
+		return use(resource, state, false, true);
+	}
+
+	// the pass has effects outside the graph and is never culled
+	RenderGraphPass &keepAlive()
+	{
+		keep = true;
+		return *this;
+	}
+
+  private:
+	// a resource used twice by the same pass is transitioned once, to the combined state
+	RenderGraphPass &use(RenderResource resource, const ResourceState &state, bool reads, bool writes)
+	{
+		for (auto &access : accesses)
+		{
+			if (access.resource != resource)
+			{
+				continue;
+			}
+
+			if (access.state.layout != state.layout)
+			{
+				throw std::runtime_error("render graph pass " + name + " uses a resource in two layouts!");
+			}
+			access.state.stage |= state.stage;
+			access.state.access |= state.access;
+			access.reads |= reads;
+			access.writes |= writes;
+			return *this;
+		}
+
+		accesses.push_back({resource, state, reads, writes});
+		return *this;
+	}
+};
+
+// Passes are added in submission order and declare which named resources
+// they read and write. compile() drops the passes nothing depends on,
+// gives transient images whose lifetimes do not overlap the same memory and
+// plans one vkCmdPipelineBarrier2 per pass with every transition it needs.
+// The graph is compiled once and executed every frame; imported images
+// such as the swapchain image are bound before each execute().
+//
+// Buffers are dependency tokens only: their barriers are merged into a
+// single global memory barrier, so the graph never needs their handles.
+class RenderGraph
+{
+  public:
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device)
+	{
+		this->physicalDevice = physicalDevice;
+		this->device         = device;
+	}
+
+	// drops every pass and resource, the gpu must be done with the transient images
+	void reset()
+	{
+		for (auto &resource : resources)
+		{
+			if (resource.kind == Kind::TransientImage && resource.image)
+			{
+				device.destroyImageView(resource.view);
+				device.destroyImage(resource.image);
+			}
+		}
+
+		for (auto &block : blocks)
+		{
+			GpuMemory::free(device, block.memory);
+		}
+
+		resources.clear();
+		passes.clear();
+		livePasses.clear();
+		blocks.clear();
+		barriers.clear();
+	}
+
+	// initial is the state the image is in before the graph, final the one it is left in
+	RenderResource importImage(const std::string &name, const ResourceState &initial, const ResourceState &final,
+	                           vk::ImageAspectFlags aspect = vk::ImageAspectFlagBits::eColor)
+	{
+		auto resource    = Resource();
+		resource.name    = name;
+		resource.kind    = Kind::ImportedImage;
+		resource.initial = initial;
+		resource.final   = final;
+		resource.aspect  = aspect;
+		return add(resource);
+	}
+
+	RenderResource importBuffer(const std::string &name, const ResourceState &initial = STATE_NONE)
+	{
+		auto resource    = Resource();
+		resource.name    = name;
+		resource.kind    = Kind::ImportedBuffer;
+		resource.initial = initial;
+		return add(resource);
+	}
+
+	RenderResource createImage(const std::string &name, const TransientImageInfo &info)
+	{
+		auto resource      = Resource();
+		resource.name      = name;
+		resource.kind      = Kind::TransientImage;
+		resource.transient = info;
+		resource.aspect    = info.aspect;
+		return add(resource);
+	}
+
+	// the contents of an output are used after the graph, passes writing it are kept
+	void markOutput(RenderResource resource)
+	{
+		resources[resource].output = true;
+	}
+
+	// the returned pass is valid until the graph is reset
+	RenderGraphPass &addPass(const std::string &name, RenderGraphPass::Execute execute)
+	{
+		passes.emplace_back();
+		auto &pass   = passes.back();
+		pass.name    = name;
+		pass.execute = std::move(execute);
+		return pass;
+	}
+
+	void bindImage(RenderResource resource, vk::Image image, vk::ImageView view)
+	{
+		resources[resource].image = image;
+		resources[resource].view  = view;
+	}
+
+	vk::Image image(RenderResource resource) const
+	{
+		return resources[resource].image;
+	}
+
+	vk::ImageView view(RenderResource resource) const
+	{
+		return resources[resource].view;
+	}
+
+	void compile()
+	{
+		PROFILE_ZONE("compile render graph");
+
+		cullPasses();
+		computeLifetimes();
+		allocateTransients();
+		planBarriers();
+	}
+
+	void execute(vk::CommandBuffer commandBuffer)
+	{
+		if (barriers.size() != livePasses.size() + 1)
+		{
+			throw std::runtime_error("render graph executed before it was compiled!");
+		}
+
+		for (size_t i = 0; i < livePasses.size(); i++)
+		{
+			recordBarriers(commandBuffer, barriers[i]);
+			passes[livePasses[i]].execute(commandBuffer, *this);
+		}
+		recordBarriers(commandBuffer, barriers.back());
+	}
+
+	size_t livePassCount() const
+	{
+		return livePasses.size();
+	}
+
+	// memory of the transient images after aliasing
+	vk::DeviceSize transientMemorySize() const
+	{
+		vk::DeviceSize size = 0;
+		for (const auto &block : blocks)
+		{
+			size += block.size;
+		}
+		return size;
+	}
+
+  private:
+	enum class Kind
+	{
+		ImportedImage,
+		ImportedBuffer,
+		TransientImage
+	};
+
+	struct Resource
+	{
+		std::string          name;
+		Kind                 kind;
+		bool                 output = false;
+		ResourceState        initial;
+		ResourceState        final;        // imported images are transitioned to it after the last pass
+		TransientImageInfo   transient;
+		vk::ImageAspectFlags aspect;
+		vk::Image            image;
+		vk::ImageView        view;
+		uint32_t             firstPass = NO_PASS;        // positions in livePasses
+		uint32_t             lastPass  = NO_PASS;
+		vk::DeviceSize       size      = 0;
+		uint32_t             typeBits  = 0;
+	};
+
+	// transient images sharing memory, in the order their lifetimes start
+	struct MemoryBlock
+	{
+		vk::DeviceMemory      memory;
+		vk::DeviceSize        size;
+		uint32_t              typeBits;
+		bool                  lazy;
+		std::vector<uint32_t> tenants;
+	};
+
+	struct ImageBarrier
+	{
+		RenderResource resource;
+		ResourceState  src;
+		ResourceState  dst;
+	};
+
+	// A resource while barriers are planned: the accesses since its last
+	// barrier, its last write, and the reads that already wait for that write.
+	// A layout transition counts as a write without access.
+	struct TrackedState
+	{
+		ResourceState           current;
+		vk::PipelineStageFlags2 writeStage;
+		vk::AccessFlags2        writeAccess;
+		vk::PipelineStageFlags2 visibleStages;
+		vk::AccessFlags2        visibleAccess;
+
+		static TrackedState from(const ResourceState &state)
+		{
+			auto tracked    = TrackedState();
+			tracked.current = state;
+			if (state.access & WRITE_ACCESS)
+			{
+				tracked.writeStage  = state.stage;
+				tracked.writeAccess = state.access & WRITE_ACCESS;
+			}
+			else
+			{
+				tracked.visibleStages = state.stage;
+				tracked.visibleAccess = state.access;
+			}
+			return tracked;
+		}
+	};
+
+	// recorded before a pass, or after the last one for the final transitions
+	struct BarrierSet
+	{
+		std::vector<ImageBarrier> images;
+		vk::MemoryBarrier2        memory;
+		bool                      hasMemory = false;
+	};
+
+	vk::PhysicalDevice                   physicalDevice;
+	vk::Device                           device;
+	std::vector<Resource>                resources;
+	std::deque<RenderGraphPass>          passes;
+	std::vector<uint32_t>                livePasses;
+	std::vector<MemoryBlock>             blocks;
+	std::vector<BarrierSet>              barriers;             // one per live pass and the final transitions
+	std::vector<vk::ImageMemoryBarrier2> imageBarriers;        // scratch space of recordBarriers
+
+	RenderResource add(const Resource &resource)
+	{
+		resources.push_back(resource);
+		return static_cast<RenderResource>(resources.size() - 1);
+	}
+
+	// walks back from the outputs, a pass is live if a live pass or an output needs what it writes
+	void cullPasses()
+	{
+		std::vector<bool> needed(resources.size());
+		for (size_t i = 0; i < resources.size(); i++)
+		{
+			needed[i] = resources[i].output;
+		}
+
+		for (size_t i = passes.size(); i-- > 0;)
+		{
+			auto &pass   = passes[i];
+			auto  isUsed = [&](const RenderGraphPass::Access &access) { return access.writes && needed[access.resource]; };
+			pass.live    = pass.keep || std::any_of(pass.accesses.begin(), pass.accesses.end(), isUsed);
+
+			if (!pass.live)
+			{
+				continue;
+			}
+			for (const auto &access : pass.accesses)
+			{
+				if (access.reads)
+				{
+					needed[access.resource] = true;
+				}
+			}
+		}
+
+		livePasses.clear();
+		for (uint32_t i = 0; i < passes.size(); i++)
+		{
+			if (passes[i].live)
+			{
+				livePasses.push_back(i);
+			}
+		}
+	}
+
+	void computeLifetimes()
+	{
+		for (uint32_t i = 0; i < livePasses.size(); i++)
+		{
+			for (const auto &access : passes[livePasses[i]].accesses)
+			{
+				auto &resource = resources[access.resource];
+				if (resource.firstPass == NO_PASS)
+				{
+					resource.firstPass = i;
+				}
+				resource.lastPass = i;
+			}
+		}
+	}
+
+	// Creates the transient images used by live passes and packs them into
+	// as few memory blocks as possible, largest first. Images only share a
+	// block when their lifetimes do not overlap; each is bound at offset 0.
+	void allocateTransients()
+	{
+		std::vector<uint32_t> images;
+		for (uint32_t i = 0; i < resources.size(); i++)
+		{
+			auto &resource = resources[i];
+			if (resource.kind != Kind::TransientImage || resource.firstPass == NO_PASS)
+			{
+				continue;
+			}
+
+			auto &info              = resource.transient;
+			auto  imageInfo         = vk::ImageCreateInfo();
+			imageInfo.imageType     = vk::ImageType::e2D;
+			imageInfo.format        = info.format;
+			imageInfo.extent        = vk::Extent3D(info.extent.width, info.extent.height, 1);
+			imageInfo.mipLevels     = 1;
+			imageInfo.arrayLayers   = 1;
+			imageInfo.samples       = info.samples;
+			imageInfo.tiling        = vk::ImageTiling::eOptimal;
+			imageInfo.usage         = info.usage;
+			imageInfo.sharingMode   = vk::SharingMode::eExclusive;
+			imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+			resource.image = device.createImage(imageInfo);
+
+			auto memRequirements = device.getImageMemoryRequirements(resource.image);
+			resource.size        = memRequirements.size;
+			resource.typeBits    = memRequirements.memoryTypeBits;
+			images.push_back(i);
+		}
+
+		std::stable_sort(images.begin(), images.end(), [&](uint32_t a, uint32_t b) { return resources[a].size > resources[b].size; });
+
+		for (uint32_t i : images)
+		{
+			auto &resource = resources[i];
+
+			// attachments that never leave tile memory can use lazily allocated memory, which must not be shared with other images
+			bool lazy = (resource.transient.usage & vk::ImageUsageFlagBits::eTransientAttachment) &&
+			            DeviceHelpers::hasMemoryType(physicalDevice, resource.typeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated);
+
+			auto fits = [&](const MemoryBlock &block) {
+				if (block.lazy != lazy || (block.typeBits & resource.typeBits) == 0)
+				{
+					return false;
+				}
+				return std::none_of(block.tenants.begin(), block.tenants.end(), [&](uint32_t tenant) {
+					return resources[tenant].firstPass <= resource.lastPass && resource.firstPass <= resources[tenant].lastPass;
+				});
+			};
+
+			auto block = std::find_if(blocks.begin(), blocks.end(), fits);
+			if (block == blocks.end())
+			{
+				blocks.push_back({nullptr, 0, resource.typeBits, lazy, {}});
+				block = blocks.end() - 1;
+			}
+
+			block->size = std::max(block->size, resource.size);
+			block->typeBits &= resource.typeBits;
+			block->tenants.push_back(i);
+		}
+
+		for (auto &block : blocks)
+		{
+			auto properties  = block.lazy ? vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eLazilyAllocated) : vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal);
+			auto memoryIndex = DeviceHelpers::findMemoryType(physicalDevice, block.typeBits, properties);
+			block.memory     = GpuMemory::allocate(device, vk::MemoryAllocateInfo(block.size, memoryIndex));
+
+			std::sort(block.tenants.begin(), block.tenants.end(), [&](uint32_t a, uint32_t b) { return resources[a].firstPass < resources[b].firstPass; });
+
+			for (uint32_t tenant : block.tenants)
+			{
+				auto &resource = resources[tenant];
+				device.bindImageMemory(resource.image, block.memory, 0);
+
+				auto viewInfo = vk::ImageViewCreateInfo(
+				    {},
+				    resource.image,
+				    vk::ImageViewType::e2D,
+				    resource.transient.format,
+				    vk::ComponentMapping(),
+				    vk::ImageSubresourceRange(resource.aspect, 0, 1, 0, 1));
+				resource.view = device.createImageView(viewInfo);
+			}
+		}
+	}
+
+	// Transient images start undefined, but must wait for the previous tenant
+	// of their memory. The first tenant of a block waits for the last one of
+	// the previous frame, so the frame's own final states are needed first.
+	void planBarriers()
+	{
+		std::vector<TrackedState> states(resources.size());
+		for (size_t i = 0; i < resources.size(); i++)
+		{
+			states[i] = TrackedState::from(resources[i].initial);
+		}
+
+		auto finalStates = states;
+		simulate(finalStates);
+
+		for (const auto &block : blocks)
+		{
+			for (size_t i = 0; i < block.tenants.size(); i++)
+			{
+				uint32_t previous = block.tenants[(i + block.tenants.size() - 1) % block.tenants.size()];
+				auto     state    = finalStates[previous].current;
+				state.layout      = vk::ImageLayout::eUndefined;
+
+				states[block.tenants[i]] = TrackedState::from(state);
+			}
+		}
+
+		barriers = simulate(states);
+	}
+
+	std::vector<BarrierSet> simulate(std::vector<TrackedState> &states)
+	{
+		std::vector<BarrierSet> sets(livePasses.size() + 1);
+
+		for (size_t i = 0; i < livePasses.size(); i++)
+		{
+			for (const auto &access : passes[livePasses[i]].accesses)
+			{
+				transition(sets[i], access.resource, states[access.resource], access.state);
+			}
+		}
+
+		for (uint32_t i = 0; i < resources.size(); i++)
+		{
+			if (resources[i].kind == Kind::ImportedImage && resources[i].firstPass != NO_PASS)
+			{
+				transition(sets.back(), i, states[i], resources[i].final);
+			}
+		}
+
+		return sets;
+	}
+
+	// Reads following reads in the same layout are merged, so the next write
+	// waits for all of them. Such a read only needs a barrier of its own when
+	// the last write is not visible to its stage and access yet. A write
+	// after reads only needs an execution dependency.
+	void transition(BarrierSet &set, RenderResource resource, TrackedState &tracked, const ResourceState &next)
+	{
+		auto &current      = tracked.current;
+		bool  isImage      = resources[resource].kind != Kind::ImportedBuffer;
+		bool  layoutChange = isImage && current.layout != next.layout;
+		bool  wasWritten   = static_cast<bool>(current.access & WRITE_ACCESS);
+		bool  writes       = static_cast<bool>(next.access & WRITE_ACCESS);
+
+		if (!layoutChange && !wasWritten && !writes)
+		{
+			bool visible = !(next.stage & ~tracked.visibleStages) && !(next.access & ~tracked.visibleAccess);
+			if (tracked.writeStage && !visible)
+			{
+				auto src   = current;
+				src.stage  = tracked.writeStage;
+				src.access = tracked.writeAccess;
+				addBarrier(set, resource, isImage, src, next);
+
+				tracked.visibleStages |= next.stage;
+				tracked.visibleAccess |= next.access;
+			}
+
+			current.stage |= next.stage;
+			current.access |= next.access;
+			return;
+		}
+
+		auto src = current;
+		if (!wasWritten)
+		{
+			src.access = vk::AccessFlagBits2::eNone;
+		}
+		addBarrier(set, resource, isImage, src, next);
+
+		if (writes)
+		{
+			tracked.writeStage    = next.stage;
+			tracked.writeAccess   = next.access & WRITE_ACCESS;
+			tracked.visibleStages = vk::PipelineStageFlagBits2::eNone;
+			tracked.visibleAccess = vk::AccessFlagBits2::eNone;
+		}
+		else
+		{
+			// later reads chain onto this barrier, which made the write visible to next
+			if (!wasWritten)
+			{
+				tracked.writeStage  = next.stage;
+				tracked.writeAccess = vk::AccessFlagBits2::eNone;
+			}
+			tracked.visibleStages = next.stage;
+			tracked.visibleAccess = next.access;
+		}
+
+		current = next;
+	}
+
+	void addBarrier(BarrierSet &set, RenderResource resource, bool isImage, const ResourceState &src, const ResourceState &dst)
+	{
+		if (isImage)
+		{
+			set.images.push_back({resource, src, dst});
+		}
+		else
+		{
+			set.memory.srcStageMask |= src.stage;
+			set.memory.srcAccessMask |= src.access;
+			set.memory.dstStageMask |= dst.stage;
+			set.memory.dstAccessMask |= dst.access;
+			set.hasMemory = true;
+		}
+	}
+
+	void recordBarriers(vk::CommandBuffer commandBuffer, const BarrierSet &set)
+	{
+		if (set.images.empty() && !set.hasMemory)
+		{
+			return;
+		}
+
+		imageBarriers.clear();
+		for (const auto &image : set.images)
+		{
+			auto &resource = resources[image.resource];
+
+			auto barrier                = vk::ImageMemoryBarrier2();
+			barrier.srcStageMask        = image.src.stage;
+			barrier.srcAccessMask       = image.src.access;
+			barrier.dstStageMask        = image.dst.stage;
+			barrier.dstAccessMask       = image.dst.access;
+			barrier.oldLayout           = image.src.layout;
+			barrier.newLayout           = image.dst.layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image               = resource.image;
+			barrier.subresourceRange    = vk::ImageSubresourceRange(resource.aspect, 0, 1, 0, 1);
+			imageBarriers.push_back(barrier);
+		}
+
+		auto dependencyInfo                    = vk::DependencyInfo();
+		dependencyInfo.memoryBarrierCount      = set.hasMemory ? 1 : 0;
+		dependencyInfo.pMemoryBarriers         = &set.memory;
+		dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+		dependencyInfo.pImageMemoryBarriers    = imageBarriers.data();
+
+		commandBuffer.pipelineBarrier2(dependencyInfo);
+	}
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue for many producers and a single consumer, based on
+// Dmitry Vyukov's bounded MPMC queue. Every cell carries a sequence number
+// that tells producers and the consumer whose turn it is, so neither side
+// ever takes a lock. Only a producer facing a full queue sleeps, on an
+// atomic wait the consumer signals once it pops.
+template <typename T, size_t Capacity>
+class MpscQueue
+{
+	static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+  public:
+	MpscQueue() :
+	    cells(new Cell[Capacity])
+	{
+		for (size_t i = 0; i < Capacity; i++)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscQueue(const MpscQueue &)            = delete;
+	MpscQueue &operator=(const MpscQueue &) = delete;
+
+	// safe from any thread, fails only when the queue is full
+	bool tryPush(T &&value)
+	{
+		Cell  *cell;
+		size_t position = enqueuePosition.load(std::memory_order_relaxed);
+
+		for (;;)
+		{
+			cell              = &cells[position & (Capacity - 1)];
+			size_t   sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t diff     = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (diff == 0)
+			{
+				if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = enqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->value = std::move(value);
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// blocks while the queue is full, use tryPush to handle that instead
+	void push(T value)
+	{
+		for (;;)
+		{
+			// a pop after this load makes the wait below return at once
+			size_t seen = popped.load(std::memory_order_seq_cst);
+			if (tryPush(std::move(value)))
+			{
+				return;
+			}
+
+			waitingProducers.fetch_add(1, std::memory_order_seq_cst);
+			popped.wait(seen, std::memory_order_seq_cst);
+			waitingProducers.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	// only the consumer thread may call this
+	bool tryPop(T &value)
+	{
+		Cell    *cell     = &cells[dequeuePosition & (Capacity - 1)];
+		size_t   sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t diff     = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(dequeuePosition + 1);
+
+		if (diff < 0)
+		{
+			return false;
+		}
+
+		value = std::move(cell->value);
+		cell->sequence.store(dequeuePosition + Capacity, std::memory_order_release);
+		dequeuePosition++;
+
+		popped.fetch_add(1, std::memory_order_seq_cst);
+		if (waitingProducers.load(std::memory_order_seq_cst) > 0)
+		{
+			popped.notify_all();
+		}
+		return true;
+	}
+
+  private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T                   value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+
+	// producers and the consumer touch different cache lines
+	alignas(64) std::atomic<size_t> enqueuePosition{0};
+	alignas(64) size_t dequeuePosition = 0;
+
+	// producers blocked in push() sleep until the consumer pops
+	std::atomic<size_t>   popped{0};
+	std::atomic<uint32_t> waitingProducers{0};
+};
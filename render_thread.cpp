@@ -0,0 +1,248 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <future>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+#include "jobs.cpp"
+#include "render_queue.cpp"
+#include "vulkan.cpp"
+
+const size_t RENDER_QUEUE_CAPACITY = 1024;
+
+struct SetTransformPacket
+{
+	glm::mat4 transform;
+};
+
+struct UpdateVerticesPacket
+{
+	std::vector<Vertex> vertices;
+};
+
+struct AddObjectPacket
+{
+	glm::mat4 model;
+	glm::vec4 tint;
+};
+
+// replaces every object drawn from the next frame on
+struct DrawListPacket
+{
+	std::vector<DrawItem> items;
+};
+
+struct ResizePacket
+{
+	uint32_t width;
+	uint32_t height;
+};
+
+// replaces the streamed chunk instances
+struct StreamChunksPacket
+{
+	std::vector<ChunkInstance> instances;
+};
+
+// replaces the sprites drawn on top of the scene
+struct DrawSpritesPacket
+{
+	std::vector<Sprite> sprites;
+};
+
+using RenderPacket = std::variant<SetTransformPacket, UpdateVerticesPacket, AddObjectPacket, DrawListPacket, ResizePacket, StreamChunksPacket, DrawSpritesPacket>;
+
+// runs on the thread that owns the renderer
+void applyRenderPacket(Vulkan *vulkan, const RenderPacket &packet)
+{
+	if (auto setTransform = std::get_if<SetTransformPacket>(&packet))
+	{
+		vulkan->setTransform(setTransform->transform);
+	}
+	else if (auto updateVertices = std::get_if<UpdateVerticesPacket>(&packet))
+	{
+		vulkan->updateVertexBuffer(updateVertices->vertices);
+	}
+	else if (auto addObject = std::get_if<AddObjectPacket>(&packet))
+	{
+		vulkan->addObject(addObject->model, addObject->tint);
+	}
+	else if (auto drawList = std::get_if<DrawListPacket>(&packet))
+	{
+		vulkan->setDrawList(drawList->items);
+	}
+	else if (auto resize = std::get_if<ResizePacket>(&packet))
+	{
+		vulkan->setFramebufferSize(resize->width, resize->height);
+	}
+	else if (auto streamChunks = std::get_if<StreamChunksPacket>(&packet))
+	{
+		vulkan->setStreamedChunks(streamChunks->instances);
+	}
+	else if (auto drawSprites = std::get_if<DrawSpritesPacket>(&packet))
+	{
+		vulkan->setSprites(drawSprites->sprites);
+	}
+}
+
+// Owns the Vulkan renderer and its queues on a dedicated thread. Any thread
+// can submit packets; they are applied between frames, so a slow producer
+// never delays presentation and producers never wait on gpu fences.
+class RenderThread
+{
+  public:
+	// returns once the renderer is initialised, rethrows its initialisation errors
+	RenderThread(GLFWwindow *window, JobSystem &jobs, uint32_t width, uint32_t height, vk::SampleCountFlagBits samples)
+	{
+		std::promise<void> ready;
+		auto               initialised = ready.get_future();
+
+		thread = std::thread(&RenderThread::run, this, window, std::ref(jobs), width, height, samples, std::move(ready));
+		try
+		{
+			initialised.get();
+		}
+		catch (...)
+		{
+			thread.join();
+			throw;
+		}
+	}
+
+	~RenderThread()
+	{
+		stop();
+	}
+
+	void submit(RenderPacket packet)
+	{
+		packets.push(std::move(packet));
+	}
+
+	// errors of the render thread surface on the thread that drives it
+	void rethrowIfFailed()
+	{
+		if (failed.load(std::memory_order_acquire))
+		{
+			std::rethrow_exception(error);
+		}
+	}
+
+	// operator tools rather than simulation, so they bypass the packets and are never captured
+	void setStatsOverlay(bool visible)
+	{
+		statsVisible.store(visible, std::memory_order_relaxed);
+	}
+
+	bool isStatsOverlayVisible() const
+	{
+		return statsVisible.load(std::memory_order_relaxed);
+	}
+
+	// writes stats-<n>.json before the next frame
+	void requestStatsDump()
+	{
+		statsDumpRequested.store(true, std::memory_order_relaxed);
+	}
+
+	void stop()
+	{
+		running.store(false, std::memory_order_release);
+		if (thread.joinable())
+		{
+			thread.join();
+		}
+	}
+
+  private:
+	std::thread                                    thread;
+	MpscQueue<RenderPacket, RENDER_QUEUE_CAPACITY> packets;
+	std::atomic<bool>                              running{true};
+	std::atomic<bool>                              failed{false};
+	std::exception_ptr                             error;
+	std::atomic<bool>                              statsVisible{false};
+	std::atomic<bool>                              statsDumpRequested{false};
+	uint32_t                                       statsDumps = 0;
+
+	void run(GLFWwindow *window, JobSystem &jobs, uint32_t width, uint32_t height, vk::SampleCountFlagBits samples, std::promise<void> ready)
+	{
+		Vulkan *vulkan;
+		try
+		{
+			// the render thread helps with the jobs it waits on
+			jobs.registerThread();
+			PROFILE_THREAD("render");
+			vulkan = new Vulkan(window, jobs, width, height, samples);
+		}
+		catch (...)
+		{
+			ready.set_exception(std::current_exception());
+			return;
+		}
+		ready.set_value();
+
+		try
+		{
+			while (running.load(std::memory_order_acquire))
+			{
+				{
+					PROFILE_ZONE("apply packets");
+					applyPackets(vulkan);
+				}
+
+				vulkan->setStatsOverlay(statsVisible.load(std::memory_order_relaxed));
+				if (statsDumpRequested.exchange(false, std::memory_order_relaxed))
+				{
+					vulkan->dumpStats("stats-" + std::to_string(statsDumps++) + ".json");
+				}
+
+				if (!vulkan->drawFrame())
+				{
+					// minimized, nothing to present until the next resize
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				}
+			}
+		}
+		catch (...)
+		{
+			fail(std::current_exception());
+		}
+
+		// after a lost device waitIdle throws as well, the loop's error is the one reported
+		try
+		{
+			vulkan->waitIdle();
+		}
+		catch (...)
+		{
+			fail(std::current_exception());
+		}
+		delete (vulkan);
+	}
+
+	// keeps the first error, later ones are usually caused by it
+	void fail(std::exception_ptr exception)
+	{
+		if (failed.load(std::memory_order_relaxed))
+		{
+			return;
+		}
+		error = exception;
+		failed.store(true, std::memory_order_release);
+	}
+
+	void applyPackets(Vulkan *vulkan)
+	{
+		RenderPacket packet;
+		while (packets.tryPop(packet))
+		{
+			applyRenderPacket(vulkan, packet);
+		}
+	}
+};
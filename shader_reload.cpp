@@ -0,0 +1,171 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "profiler.cpp"
+#include "render_queue.cpp"
+
+// how often the shader sources are checked for changes
+const auto SHADER_POLL_INTERVAL = std::chrono::milliseconds(250);
+
+// the build compiles every shader source to <source>.spv next to it
+const char *SHADER_BINARY_EXTENSION = ".spv";
+
+struct ShaderSource
+{
+	std::string name;          // file name of the source, shader.vert
+	std::string source;        // glsl file
+	std::string binary;        // spir-v file the renderer loads
+};
+
+// the spir-v the build writes for a glsl file
+static std::string shaderBinaryPath(const std::string &source)
+{
+	return source + SHADER_BINARY_EXTENSION;
+}
+
+// every glsl source in directory, found the same way as by the build
+static std::vector<ShaderSource> findShaderSources(const std::string &directory)
+{
+	std::vector<ShaderSource> shaders;
+	std::error_code           error;
+	for (const auto &entry : std::filesystem::directory_iterator(directory, error))
+	{
+		auto extension = entry.path().extension();
+		if (extension == ".vert" || extension == ".frag" || extension == ".comp")
+		{
+			auto source = entry.path().generic_string();
+			shaders.push_back({entry.path().filename().string(), source, shaderBinaryPath(source)});
+		}
+	}
+	return shaders;
+}
+
+// Watches shader sources and recompiles them with glslc on its own thread
+// when they change, so a slow compile never stalls a frame. A successful
+// compile replaces the binary and is reported through changed(), which the
+// renderer polls at a frame boundary to rebuild the pipelines using it.
+// Errors are printed and the old binary stays in use.
+class ShaderWatcher
+{
+  public:
+	ShaderWatcher(const std::string &compiler, const std::vector<ShaderSource> &shaders) :
+	    compiler(compiler), shaders(shaders), writeTimes(shaders.size())
+	{
+		// sources older than the binaries were compiled by the build
+		for (size_t i = 0; i < shaders.size(); i++)
+		{
+			std::error_code error;
+			writeTimes[i] = std::filesystem::last_write_time(shaders[i].source, error);
+		}
+
+		thread = std::thread(&ShaderWatcher::run, this);
+	}
+
+	~ShaderWatcher()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_one();
+		thread.join();
+	}
+
+	ShaderWatcher(const ShaderWatcher &)            = delete;
+	ShaderWatcher &operator=(const ShaderWatcher &) = delete;
+
+	// name of a shader whose binary was replaced since the last call, only one thread may call this
+	bool changed(std::string &name)
+	{
+		uint32_t shader;
+		if (!compiled.tryPop(shader))
+		{
+			return false;
+		}
+		name = shaders[shader].name;
+		return true;
+	}
+
+  private:
+	std::string                                  compiler;
+	std::vector<ShaderSource>                    shaders;
+	std::vector<std::filesystem::file_time_type> writeTimes;        // of the last compiled version
+	MpscQueue<uint32_t, 64>                      compiled;
+	std::mutex                                   mutex;
+	std::condition_variable                      wake;
+	bool                                         stopping = false;
+	std::thread                                  thread;
+
+	void run()
+	{
+		PROFILE_THREAD("shader watcher");
+
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!wake.wait_for(lock, SHADER_POLL_INTERVAL, [this] { return stopping; }))
+		{
+			lock.unlock();
+			check();
+			lock.lock();
+		}
+	}
+
+	void check()
+	{
+		for (uint32_t i = 0; i < shaders.size(); i++)
+		{
+			// editors may replace the file, a missing source is checked again next time
+			std::error_code error;
+			auto            writeTime = std::filesystem::last_write_time(shaders[i].source, error);
+			if (error || writeTime == writeTimes[i])
+			{
+				continue;
+			}
+
+			writeTimes[i] = writeTime;
+			if (compile(shaders[i]))
+			{
+				compiled.push(i);
+			}
+		}
+	}
+
+	// compiles to a temporary file first, so a failed compile keeps the old binary
+	bool compile(const ShaderSource &shader)
+	{
+		PROFILE_ZONE("compile shader");
+
+		auto temporary = shader.binary + ".tmp";
+		auto command   = "\"" + compiler + "\" \"" + shader.source + "\" -o \"" + temporary + "\"";
+#ifdef _WIN32
+		// cmd strips the outer quotes of the whole line
+		command = "\"" + command + "\"";
+#endif
+
+		std::cout << "Compiling " << shader.source << "\n";
+		if (std::system(command.c_str()) != 0)
+		{
+			std::cout << "Failed to compile " << shader.source << ", keeping the previous version\n";
+			std::remove(temporary.c_str());
+			return false;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporary, shader.binary, error);
+		if (error)
+		{
+			std::cout << "Failed to replace " << shader.binary << ": " << error.message() << "\n";
+			return false;
+		}
+		return true;
+	}
+};
@@ -1,2 +1 @@
-C:/dev/VulkanSDK/Bin/glslc.exe shader.vert -o vert.spv
-C:/dev/VulkanSDK/Bin/glslc.exe shader.frag -o frag.spv
\ No newline at end of file
+for %%s in (*.vert *.frag *.comp) do C:/dev/VulkanSDK/Bin/glslc.exe %%s -o %%s.spv
\ No newline at end of file
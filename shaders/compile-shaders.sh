@@ -1,2 +1,3 @@
-~/VulkanSDK/1.3.296.0/macOS/bin/glslc shader.vert -o vert.spv
-~/VulkanSDK/1.3.296.0/macOS/bin/glslc shader.frag -o frag.spv
\ No newline at end of file
+for shader in *.vert *.frag *.comp; do
+    ~/VulkanSDK/1.3.296.0/macOS/bin/glslc "$shader" -o "$shader.spv"
+done
@@ -1,9 +1,22 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// global bindless set, see descriptors.cpp
+layout(set = 0, binding = 1) uniform sampler2D textures[];
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
 
 layout(location = 0) out vec4 outColor;
 
+// pipeline variants, see PipelineKey in pipelines.cpp
+layout(constant_id = 0) const bool TEXTURED = true;
+
 void main() {
     outColor = vec4(fragColor, 1.0);
+    if (TEXTURED) {
+        // draws of one indirect batch may use different textures
+        outColor *= texture(textures[nonuniformEXT(fragTexture)], fragTexCoord);
+    }
 }
\ No newline at end of file
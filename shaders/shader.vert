@@ -1,11 +1,48 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct ObjectData {
+    mat4 model;
+    vec4 boundingSphere;
+    vec4 tint;
+    uint mesh;
+    uint texture;
+    uint padding0;
+    uint padding1;
+};
+
+// global bindless set, see descriptors.cpp
+layout(set = 0, binding = 0) readonly buffer ObjectBuffer {
+    ObjectData objects[];
+} objectBuffers[];
+
+layout(set = 1, binding = 0) uniform FrameUniforms {
+    mat4 view;
+    mat4 proj;
+} frame;
+
+layout(push_constant) uniform PushConstants {
+    mat4 transform;
+    uint objectBuffer;
+} pc;
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
+
+// pipeline variants, see PipelineKey in pipelines.cpp
+layout(constant_id = 1) const bool VERTEX_COLORS = true;
 
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
+    // firstInstance of the draw is the object index
+    ObjectData object = objectBuffers[pc.objectBuffer].objects[gl_InstanceIndex];
+
+    gl_Position = frame.proj * frame.view * pc.transform * object.model * vec4(inPosition, 0.0, 1.0);
+    fragColor = (VERTEX_COLORS ? inColor : vec3(1.0)) * object.tint.rgb;
+    fragTexCoord = inTexCoord;
+    fragTexture = object.texture;
 }
\ No newline at end of file
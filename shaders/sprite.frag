@@ -0,0 +1,16 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// global bindless set, see descriptors.cpp
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) flat in uint fragTexture;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    // one draw covers every texture of a blend mode
+    outColor = fragColor * texture(textures[nonuniformEXT(fragTexture)], fragTexCoord);
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct SpriteQuad {
+    vec2 position;
+    vec2 size;
+    uint uvMin;
+    uint uvMax;
+    uint color;
+    uint texture;
+};
+
+// global bindless set, see descriptors.cpp
+layout(set = 0, binding = 0) readonly buffer QuadBuffer {
+    SpriteQuad quads[];
+} quadBuffers[];
+
+layout(set = 0, binding = 0) readonly buffer OrderBuffer {
+    uint order[];
+} orderBuffers[];
+
+layout(push_constant) uniform SpriteConstants {
+    vec2 pixelToClip;
+    uint quadBuffer;
+    uint orderBuffer;
+} pc;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragTexture;
+
+// two triangles per quad, there is no vertex or index buffer
+const vec2 CORNERS[6] = vec2[](
+    vec2(0.0, 0.0), vec2(1.0, 0.0), vec2(1.0, 1.0),
+    vec2(0.0, 0.0), vec2(1.0, 1.0), vec2(0.0, 1.0));
+
+void main() {
+    // quads are drawn in the sorted order, not in the order they were written
+    uint index = orderBuffers[pc.orderBuffer].order[gl_VertexIndex / 6];
+    SpriteQuad quad = quadBuffers[pc.quadBuffer].quads[index];
+    vec2 corner = CORNERS[gl_VertexIndex % 6];
+
+    vec2 pixel = quad.position + corner * quad.size;
+    gl_Position = vec4(pixel * pc.pixelToClip - 1.0, 0.0, 1.0);
+    fragColor = unpackUnorm4x8(quad.color);
+    fragTexCoord = mix(unpackUnorm2x16(quad.uvMin), unpackUnorm2x16(quad.uvMax), corner);
+    fragTexture = quad.texture;
+}
\ No newline at end of file
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "descriptors.cpp"
+#include "device_helpers.cpp"
+#include "gpu_memory.cpp"
+#include "pipelines.cpp"
+#include "profiler.cpp"
+
+const uint32_t MAX_SPRITES = 1 << 20;        // per frame, unless a batch is created smaller
+
+// a sprite as the game submits it, see DrawSpritesPacket
+struct Sprite
+{
+	glm::vec2 position;        // top left corner, in pixels from the top left of the window
+	glm::vec2 size;            // in pixels
+	glm::vec4 uvRect;          // min and max texture coordinates
+	glm::vec4 color;
+	uint32_t  texture;         // texture file index, untextured past the last file
+	uint8_t   layer;           // higher layers are drawn on top
+	BlendMode blend;
+	uint8_t   padding[2];
+};
+
+// must match SpriteQuad in sprite.vert
+struct SpriteQuad
+{
+	glm::vec2 position;
+	glm::vec2 size;
+	uint32_t  uvMin;          // unorm16x2
+	uint32_t  uvMax;          // unorm16x2
+	uint32_t  color;          // unorm8x4
+	uint32_t  texture;        // bindless slot
+};
+
+// must match the push constants in sprite.vert
+struct SpriteConstants
+{
+	glm::vec2 pixelToClip;
+	uint32_t  quadBuffer;
+	uint32_t  orderBuffer;
+};
+
+// Sorts the items by their upper 32 bits, stable, so sprites with equal
+// keys keep their submission order. Byte passes where every key has the
+// same digit are skipped, most batches only differ in a few key bits.
+// Returns whichever of the two arrays holds the result.
+static const uint64_t *radixSortByKey(uint64_t *items, uint64_t *scratch, size_t count)
+{
+	std::array<std::array<uint32_t, 256>, 4> histograms = {};
+	for (size_t i = 0; i < count; i++)
+	{
+		uint32_t key = static_cast<uint32_t>(items[i] >> 32);
+		for (uint32_t b = 0; b < 4; b++)
+		{
+			histograms[b][(key >> (b * 8)) & 0xff]++;
+		}
+	}
+
+	uint64_t *source      = items;
+	uint64_t *destination = scratch;
+	for (uint32_t b = 0; b < 4; b++)
+	{
+		uint32_t shift     = 32 + b * 8;
+		auto    &histogram = histograms[b];
+		if (count == 0 || histogram[(source[0] >> shift) & 0xff] == count)
+		{
+			continue;
+		}
+
+		std::array<uint32_t, 256> offsets;
+		uint32_t                  sum = 0;
+		for (uint32_t digit = 0; digit < 256; digit++)
+		{
+			offsets[digit] = sum;
+			sum += histogram[digit];
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			destination[offsets[(source[i] >> shift) & 0xff]++] = source[i];
+		}
+		std::swap(source, destination);
+	}
+
+	return source;
+}
+
+// Batches screen space quads for the hud and other 2d content. Quads are
+// written straight into the frame's persistently mapped buffer, in any
+// order; end() sorts their indices by layer, blend mode and texture with a
+// radix sort and the vertex shader reads the quads through that order.
+// Textures are bindless, so only a blend mode change splits a draw.
+class SpriteBatch
+{
+  public:
+	// variants of the sprite shaders, one per blend mode
+	PipelineManager pipelines;
+
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device, BindlessDescriptors &bindless, JobSystem &jobs,
+	            const PipelineManager::Targets &targets, const std::string &vertexShader, const std::string &fragmentShader,
+	            uint32_t whiteTexture, uint32_t framesInFlight, uint32_t capacity = MAX_SPRITES)
+	{
+		this->physicalDevice = physicalDevice;
+		this->device         = device;
+		this->bindless       = &bindless;
+		this->whiteTexture   = whiteTexture;
+		this->capacity       = capacity;
+
+		auto pushConstantRange  = vk::PushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(SpriteConstants));
+		auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo({}, 1, &bindless.layout, 1, &pushConstantRange);
+		layout                  = device.createPipelineLayout(pipelineLayoutInfo);
+
+		pipelines.create(device, jobs, layout, targets, vertexShader, fragmentShader, false);
+		pipelines.prepare(pipelineKey(BlendMode::Alpha));
+
+		frames.resize(framesInFlight);
+		for (auto &frame : frames)
+		{
+			frame.quadBuffer  = createBuffer(sizeof(SpriteQuad) * capacity, frame.quadMemory);
+			frame.orderBuffer = createBuffer(sizeof(uint32_t) * capacity, frame.orderMemory);
+			frame.quads       = static_cast<SpriteQuad *>(device.mapMemory(frame.quadMemory, 0, VK_WHOLE_SIZE));
+			frame.order       = static_cast<uint32_t *>(device.mapMemory(frame.orderMemory, 0, VK_WHOLE_SIZE));
+			frame.quadSlot    = bindless.registerStorageBuffer(frame.quadBuffer);
+			frame.orderSlot   = bindless.registerStorageBuffer(frame.orderBuffer);
+		}
+
+		keys.resize(capacity);
+		scratch.resize(capacity);
+	}
+
+	void destroy()
+	{
+		pipelines.destroy();
+		device.destroyPipelineLayout(layout);
+
+		for (auto &frame : frames)
+		{
+			bindless->releaseStorageBuffer(frame.quadSlot);
+			bindless->releaseStorageBuffer(frame.orderSlot);
+			device.destroyBuffer(frame.quadBuffer);
+			device.destroyBuffer(frame.orderBuffer);
+			GpuMemory::free(device, frame.quadMemory);
+			GpuMemory::free(device, frame.orderMemory);
+		}
+	}
+
+	// the frame's buffers are free again once its fence has signaled,
+	// blend mode variants built in the background since the last frame are added
+	void begin(uint32_t frame)
+	{
+		pipelines.beginFrame();
+		current = &frames[frame];
+		count   = 0;
+	}
+
+	// space for sprites filled in with set(), returns how many fit; set() may then
+	// be called from any thread, as long as every index is written by one thread
+	uint32_t reserve(uint32_t wanted, uint32_t &first)
+	{
+		first        = count;
+		uint32_t fit = std::min(wanted, capacity - count);
+		count += fit;
+		return fit;
+	}
+
+	// texture is a bindless slot
+	void set(uint32_t index, glm::vec2 position, glm::vec2 size, uint32_t texture, glm::vec4 uvRect, glm::vec4 color,
+	         uint8_t layer = 0, BlendMode blend = BlendMode::Alpha)
+	{
+		// written in order as a whole, the mapped memory may be write-combined
+		auto quad     = SpriteQuad();
+		quad.position = position;
+		quad.size     = size;
+		quad.uvMin    = glm::packUnorm2x16(glm::vec2(uvRect.x, uvRect.y));
+		quad.uvMax    = glm::packUnorm2x16(glm::vec2(uvRect.z, uvRect.w));
+		quad.color    = glm::packUnorm4x8(color);
+		quad.texture  = texture;
+
+		current->quads[index] = quad;
+		keys[index]           = uint64_t(sortKey(layer, blend, texture)) << 32 | index;
+	}
+
+	// returns false once the batch is full
+	bool addSprite(glm::vec2 position, glm::vec2 size, uint32_t texture, glm::vec4 uvRect = glm::vec4(0, 0, 1, 1),
+	               glm::vec4 color = glm::vec4(1.0f), uint8_t layer = 0, BlendMode blend = BlendMode::Alpha)
+	{
+		uint32_t index;
+		if (reserve(1, index) == 0)
+		{
+			return false;
+		}
+
+		set(index, position, size, texture, uvRect, color, layer, blend);
+		return true;
+	}
+
+	bool addQuad(glm::vec2 position, glm::vec2 size, glm::vec4 color, uint8_t layer = 0, BlendMode blend = BlendMode::Alpha)
+	{
+		return addSprite(position, size, whiteTexture, glm::vec4(0, 0, 1, 1), color, layer, blend);
+	}
+
+	// sorts the batch and writes the draw order, before the frame is recorded
+	void end()
+	{
+		PROFILE_ZONE("sort sprites");
+
+		draws.clear();
+		if (count == 0)
+		{
+			return;
+		}
+
+		auto sorted = radixSortByKey(keys.data(), scratch.data(), count);
+
+		for (uint32_t i = 0; i < count; i++)
+		{
+			current->order[i] = static_cast<uint32_t>(sorted[i]);
+
+			auto blend = static_cast<BlendMode>((sorted[i] >> 54) & 0x3);
+			if (draws.empty() || draws.back().blend != blend)
+			{
+				draws.push_back({blend, i, 0});
+			}
+			draws.back().count++;
+		}
+	}
+
+	// inside rendering, after the viewport and scissor are set
+	void record(vk::CommandBuffer commandBuffer, vk::Extent2D extent)
+	{
+		if (draws.empty())
+		{
+			return;
+		}
+
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, layout, 0, 1, &bindless->set, 0, nullptr);
+
+		auto constants        = SpriteConstants();
+		constants.pixelToClip = glm::vec2(2.0f / extent.width, 2.0f / extent.height);
+		constants.quadBuffer  = current->quadSlot;
+		constants.orderBuffer = current->orderSlot;
+		commandBuffer.pushConstants(layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(SpriteConstants), &constants);
+
+		vk::Pipeline bound;
+		for (const auto &draw : draws)
+		{
+			// variants still being built are skipped for now
+			auto pipeline = pipelines.get(pipelineKey(draw.blend));
+			if (!pipeline)
+			{
+				continue;
+			}
+			if (pipeline != bound)
+			{
+				commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+				bound = pipeline;
+			}
+
+			// six vertices per quad, no vertex or index buffer
+			commandBuffer.draw(6 * draw.count, 1, 6 * draw.first, 0);
+		}
+	}
+
+	uint32_t spriteCount() const
+	{
+		return count;
+	}
+
+	size_t drawCount() const
+	{
+		return draws.size();
+	}
+
+  private:
+	struct Frame
+	{
+		vk::Buffer       quadBuffer;
+		vk::DeviceMemory quadMemory;
+		SpriteQuad      *quads;
+		uint32_t         quadSlot;
+		vk::Buffer       orderBuffer;
+		vk::DeviceMemory orderMemory;
+		uint32_t        *order;
+		uint32_t         orderSlot;
+	};
+
+	// sprites sharing a pipeline, a range of the sorted order
+	struct Draw
+	{
+		BlendMode blend;
+		uint32_t  first;
+		uint32_t  count;
+	};
+
+	vk::PhysicalDevice    physicalDevice;
+	vk::Device            device;
+	BindlessDescriptors  *bindless;
+	vk::PipelineLayout    layout;
+	uint32_t              whiteTexture;
+	uint32_t              capacity;
+	std::vector<Frame>    frames;
+	Frame                *current = nullptr;
+	uint32_t              count   = 0;
+	std::vector<uint64_t> keys;           // sort key in the upper, quad index in the lower 32 bits
+	std::vector<uint64_t> scratch;        // second buffer of the radix sort
+	std::vector<Draw>     draws;
+
+	// 8 bits layer, 2 bits blend mode, 22 bits texture slot
+	static uint32_t sortKey(uint8_t layer, BlendMode blend, uint32_t texture)
+	{
+		return uint32_t(layer) << 24 | uint32_t(blend) << 22 | (texture & 0x3fffff);
+	}
+
+	static PipelineKey pipelineKey(BlendMode blend)
+	{
+		auto key     = PipelineKey();
+		key.cullMode = vk::CullModeFlagBits::eNone;
+		key.blend    = blend;
+		key.features = 0;
+		return key;
+	}
+
+	vk::Buffer createBuffer(vk::DeviceSize size, vk::DeviceMemory &memory)
+	{
+		auto buffer       = device.createBuffer(vk::BufferCreateInfo({}, size, vk::BufferUsageFlagBits::eStorageBuffer));
+		auto requirements = device.getBufferMemoryRequirements(buffer);
+		auto properties   = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+		auto memoryIndex  = DeviceHelpers::findMemoryType(physicalDevice, requirements.memoryTypeBits, properties);
+		memory            = GpuMemory::allocate(device, vk::MemoryAllocateInfo(requirements.size, memoryIndex));
+		device.bindBufferMemory(buffer, memory, 0);
+		return buffer;
+	}
+};
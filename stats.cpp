@@ -0,0 +1,277 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gpu_memory.cpp"
+#include "profiler.cpp"
+#include "sprites.cpp"
+
+// frames kept for the overlay graphs
+const uint32_t STATS_HISTORY_FRAMES = 240;
+
+// upper edges of the frame time histogram buckets in milliseconds, the last bucket is open
+const std::array<double, 8> FRAME_TIME_BUCKETS_MS = {4.0, 8.0, 12.0, 17.0, 25.0, 34.0, 50.0, 100.0};
+
+// quads of the overlay per frame
+const uint32_t STATS_OVERLAY_QUADS = 1024;
+
+struct HeapStats
+{
+	vk::DeviceSize size;
+	vk::DeviceSize budget;                // from VK_EXT_memory_budget, the heap size without it
+	vk::DeviceSize usage;                 // of every process, our own allocations without the extension
+	vk::DeviceSize allocatedBytes;        // by this renderer
+	uint32_t       allocations;
+	bool           deviceLocal;
+};
+
+// Memory, resource and timing statistics of the renderer. Frame times and
+// upload bytes are added every frame; heaps and resources are only
+// refreshed when the overlay or a dump needs them.
+struct RendererStats
+{
+	using FrameTimeHistogram = std::array<uint64_t, FRAME_TIME_BUCKETS_MS.size() + 1>;
+
+	uint64_t                                       frame              = 0;
+	bool                                           memoryBudget       = false;
+	std::vector<HeapStats>                         heaps;
+	uint32_t                                       allocations        = 0;
+	uint64_t                                       totalAllocations   = 0;
+	std::vector<std::pair<const char *, uint64_t>> resources;                   // live objects by type
+	FrameTimeHistogram                             frameTimeHistogram = {};
+	std::array<float, STATS_HISTORY_FRAMES>        frameTimes         = {};        // milliseconds, a ring indexed by frame
+	std::array<uint64_t, STATS_HISTORY_FRAMES>     uploadBytes        = {};        // ring like frameTimes
+	uint64_t                                       totalUploadBytes   = 0;
+
+	void addFrame(double frameMs, uint64_t frameUploadBytes)
+	{
+		frame++;
+
+		size_t bucket = 0;
+		while (bucket < FRAME_TIME_BUCKETS_MS.size() && frameMs > FRAME_TIME_BUCKETS_MS[bucket])
+		{
+			bucket++;
+		}
+		frameTimeHistogram[bucket]++;
+
+		frameTimes[frame % STATS_HISTORY_FRAMES]  = static_cast<float>(frameMs);
+		uploadBytes[frame % STATS_HISTORY_FRAMES] = frameUploadBytes;
+		totalUploadBytes += frameUploadBytes;
+	}
+
+	// usage and budget per heap, with the allocations GpuMemory tracked in each
+	void refreshHeaps(vk::PhysicalDevice physicalDevice)
+	{
+		vk::PhysicalDeviceMemoryProperties          memory;
+		vk::PhysicalDeviceMemoryBudgetPropertiesEXT budget;
+		if (memoryBudget)
+		{
+			auto properties = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+			memory          = properties.get<vk::PhysicalDeviceMemoryProperties2>().memoryProperties;
+			budget          = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+		}
+		else
+		{
+			memory = physicalDevice.getMemoryProperties();
+		}
+
+		heaps.assign(memory.memoryHeapCount, HeapStats());
+		for (uint32_t i = 0; i < memory.memoryHeapCount; i++)
+		{
+			heaps[i].size        = memory.memoryHeaps[i].size;
+			heaps[i].deviceLocal = static_cast<bool>(memory.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal);
+		}
+
+		auto counters = GpuMemory::counters();
+		for (uint32_t i = 0; i < memory.memoryTypeCount; i++)
+		{
+			auto &heap = heaps[memory.memoryTypes[i].heapIndex];
+			heap.allocations += counters.typeAllocations[i];
+			heap.allocatedBytes += counters.typeBytes[i];
+		}
+
+		// without the extension only our own allocations are known
+		for (uint32_t i = 0; i < memory.memoryHeapCount; i++)
+		{
+			heaps[i].budget = memoryBudget ? budget.heapBudget[i] : heaps[i].size;
+			heaps[i].usage  = memoryBudget ? budget.heapUsage[i] : heaps[i].allocatedBytes;
+		}
+
+		allocations      = counters.allocations;
+		totalAllocations = counters.totalAllocations;
+	}
+
+	void writeJson(const std::string &path) const
+	{
+		std::ofstream file(path, std::ios::trunc);
+		if (!file)
+		{
+			throw std::runtime_error("failed to open stats file!");
+		}
+
+		file << "{\n\"frame\":" << frame << ",\n\"memoryBudget\":" << (memoryBudget ? "true" : "false") << ",\n\"heaps\":[";
+		for (size_t i = 0; i < heaps.size(); i++)
+		{
+			auto &heap = heaps[i];
+			file << (i == 0 ? "\n" : ",\n") << "{\"size\":" << heap.size << ",\"budget\":" << heap.budget << ",\"usage\":" << heap.usage
+			     << ",\"allocatedBytes\":" << heap.allocatedBytes << ",\"allocations\":" << heap.allocations
+			     << ",\"deviceLocal\":" << (heap.deviceLocal ? "true" : "false") << "}";
+		}
+		file << "\n],\n\"allocations\":" << allocations << ",\n\"totalAllocations\":" << totalAllocations << ",\n\"resources\":{";
+		for (size_t i = 0; i < resources.size(); i++)
+		{
+			file << (i == 0 ? "\n" : ",\n") << "\"" << resources[i].first << "\":" << resources[i].second;
+		}
+
+		// the buckets are named by their upper edge
+		file << "\n},\n\"frameTimeHistogramMs\":{";
+		for (size_t i = 0; i < frameTimeHistogram.size(); i++)
+		{
+			auto edge = i < FRAME_TIME_BUCKETS_MS.size() ? std::to_string(static_cast<int>(FRAME_TIME_BUCKETS_MS[i])) : "inf";
+			file << (i == 0 ? "" : ",") << "\"" << edge << "\":" << frameTimeHistogram[i];
+		}
+
+		// recent frames, oldest first
+		uint64_t recent = std::min<uint64_t>(frame, STATS_HISTORY_FRAMES);
+		file << "},\n\"frameTimesMs\":[";
+		for (uint64_t f = frame - recent + 1; f <= frame; f++)
+		{
+			file << (f == frame - recent + 1 ? "" : ",") << frameTimes[f % STATS_HISTORY_FRAMES];
+		}
+		file << "],\n\"uploadBytes\":[";
+		for (uint64_t f = frame - recent + 1; f <= frame; f++)
+		{
+			file << (f == frame - recent + 1 ? "" : ",") << uploadBytes[f % STATS_HISTORY_FRAMES];
+		}
+		file << "],\n\"totalUploadBytes\":" << totalUploadBytes << "\n}\n";
+	}
+};
+
+// Draws the statistics as bars in the top left corner, with a small sprite
+// batch of its own so it never competes with the game's sprites for space
+// or draw order. There is no font, the numbers are in the json dump:
+//  - one bar per heap, usage against budget, our allocations below it
+//  - frame times of the recent frames, the line marks 60 fps
+//  - the frame time histogram, each bucket relative to the largest
+//  - upload bytes of the recent frames, against uploadBytesLimit
+class StatsOverlay
+{
+  public:
+	SpriteBatch batch;
+
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device, BindlessDescriptors &bindless, JobSystem &jobs,
+	            const PipelineManager::Targets &targets, const std::string &vertexShader, const std::string &fragmentShader,
+	            uint32_t whiteTexture, uint32_t framesInFlight, vk::DeviceSize uploadBytesLimit)
+	{
+		this->uploadBytesLimit = uploadBytesLimit;
+		batch.create(physicalDevice, device, bindless, jobs, targets, vertexShader, fragmentShader, whiteTexture, framesInFlight, STATS_OVERLAY_QUADS);
+	}
+
+	void destroy()
+	{
+		batch.destroy();
+	}
+
+	// fills the frame's batch, an empty batch when hidden
+	void update(uint32_t frame, const RendererStats &stats, bool visible)
+	{
+		PROFILE_ZONE("stats overlay");
+
+		batch.begin(frame);
+		if (visible)
+		{
+			addPanel(stats);
+		}
+		batch.end();
+	}
+
+	void record(vk::CommandBuffer commandBuffer, vk::Extent2D extent)
+	{
+		batch.record(commandBuffer, extent);
+	}
+
+  private:
+	vk::DeviceSize uploadBytesLimit;
+
+	static constexpr float MARGIN    = 8.0f;
+	static constexpr float WIDTH     = STATS_HISTORY_FRAMES;        // one pixel per frame in the graphs
+	static constexpr float BAR       = 6.0f;
+	static constexpr float GRAPH     = 48.0f;
+	static constexpr float GAP       = 6.0f;
+	static constexpr float GRAPH_MS  = 50.0f;        // frame time at the top of the graph
+	static constexpr float TARGET_MS = 1000.0f / 60.0f;
+
+	const glm::vec4 BACKGROUND = glm::vec4(0.0f, 0.0f, 0.0f, 0.6f);
+	const glm::vec4 EMPTY      = glm::vec4(1.0f, 1.0f, 1.0f, 0.15f);
+	const glm::vec4 GOOD       = glm::vec4(0.3f, 0.9f, 0.3f, 0.9f);
+	const glm::vec4 WARNING    = glm::vec4(0.95f, 0.8f, 0.2f, 0.9f);
+	const glm::vec4 BAD        = glm::vec4(0.95f, 0.25f, 0.2f, 0.9f);
+	const glm::vec4 OWN        = glm::vec4(0.3f, 0.6f, 1.0f, 0.9f);
+
+	void addPanel(const RendererStats &stats)
+	{
+		float    y      = MARGIN + GAP;
+		float    x      = MARGIN + GAP;
+		uint64_t recent = std::min<uint64_t>(stats.frame, STATS_HISTORY_FRAMES);
+
+		for (const auto &heap : stats.heaps)
+		{
+			float budget = static_cast<float>(std::max<vk::DeviceSize>(heap.budget, 1));
+			float usage  = std::min(static_cast<float>(heap.usage) / budget, 1.0f);
+			float own    = std::min(static_cast<float>(heap.allocatedBytes) / budget, 1.0f);
+			bar(x, y, usage, usage < 0.75f ? GOOD : usage < 0.9f ? WARNING : BAD);
+			bar(x, y + BAR, own, OWN);
+			y += 2 * BAR + GAP;
+		}
+
+		batch.addQuad(glm::vec2(x, y), glm::vec2(WIDTH, GRAPH), EMPTY, 1);
+		for (uint64_t f = stats.frame - recent + 1; f <= stats.frame; f++)
+		{
+			float ms     = stats.frameTimes[f % STATS_HISTORY_FRAMES];
+			float height = std::min(ms / GRAPH_MS, 1.0f) * GRAPH;
+			auto  color  = ms <= TARGET_MS ? GOOD : ms <= 2 * TARGET_MS ? WARNING : BAD;
+			batch.addQuad(glm::vec2(x + WIDTH - (stats.frame - f) - 1, y + GRAPH - height), glm::vec2(1.0f, height), color, 2);
+		}
+		batch.addQuad(glm::vec2(x, y + GRAPH - TARGET_MS / GRAPH_MS * GRAPH), glm::vec2(WIDTH, 1.0f), EMPTY, 3);
+		y += GRAPH + GAP;
+
+		uint64_t largest = std::max<uint64_t>(*std::max_element(stats.frameTimeHistogram.begin(), stats.frameTimeHistogram.end()), 1);
+		float    column  = WIDTH / stats.frameTimeHistogram.size();
+		batch.addQuad(glm::vec2(x, y), glm::vec2(WIDTH, GRAPH), EMPTY, 1);
+		for (size_t i = 0; i < stats.frameTimeHistogram.size(); i++)
+		{
+			float height = static_cast<float>(stats.frameTimeHistogram[i]) / largest * GRAPH;
+			float edge   = i < FRAME_TIME_BUCKETS_MS.size() ? static_cast<float>(FRAME_TIME_BUCKETS_MS[i]) : GRAPH_MS * 2;
+			auto  color  = edge <= TARGET_MS + 1.0f ? GOOD : edge <= 2 * TARGET_MS + 1.0f ? WARNING : BAD;
+			batch.addQuad(glm::vec2(x + i * column + 1.0f, y + GRAPH - height), glm::vec2(column - 2.0f, height), color, 2);
+		}
+		y += GRAPH + GAP;
+
+		batch.addQuad(glm::vec2(x, y), glm::vec2(WIDTH, GRAPH), EMPTY, 1);
+		for (uint64_t f = stats.frame - recent + 1; f <= stats.frame; f++)
+		{
+			float share  = static_cast<float>(stats.uploadBytes[f % STATS_HISTORY_FRAMES]) / std::max<vk::DeviceSize>(uploadBytesLimit, 1);
+			float height = std::min(share, 1.0f) * GRAPH;
+			batch.addQuad(glm::vec2(x + WIDTH - (stats.frame - f) - 1, y + GRAPH - height), glm::vec2(1.0f, height), OWN, 2);
+		}
+		y += GRAPH + GAP;
+
+		batch.addQuad(glm::vec2(MARGIN), glm::vec2(WIDTH + 2 * GAP, y - MARGIN), BACKGROUND, 0);
+	}
+
+	// a full width bar filled up to fraction
+	void bar(float x, float y, float fraction, glm::vec4 color)
+	{
+		batch.addQuad(glm::vec2(x, y), glm::vec2(WIDTH, BAR - 1.0f), EMPTY, 1);
+		batch.addQuad(glm::vec2(x, y), glm::vec2(WIDTH * fraction, BAR - 1.0f), color, 2);
+	}
+};
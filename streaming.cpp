@@ -0,0 +1,758 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "culling.cpp"
+#include "device_helpers.cpp"
+#include "gpu_memory.cpp"
+#include "jobs.cpp"
+#include "lod.cpp"
+#include "profiler.cpp"
+#include "render_queue.cpp"
+#include "vertexData.cpp"
+
+// chunk files hold one mesh: magic, version, vertex count, index count,
+// bounding sphere, the MeshLods table, then the raw Vertex array and the
+// uint32 indices of every level of detail
+const char     CHUNK_MAGIC[4]  = {'T', 'G', 'C', 'H'};
+const uint32_t CHUNK_VERSION   = 3;
+const char    *CHUNK_EXTENSION = ".chunk";
+
+// *.chunk files in this directory are streamed
+const char *STREAMING_DIRECTORY = "chunks";
+
+// every chunk fits into one fixed-size slot of the gpu heap
+const uint32_t       CHUNK_SLOT_VERTICES       = 1 << 16;
+const uint32_t       CHUNK_SLOT_INDICES        = 3 << 16;
+const vk::DeviceSize CHUNK_SLOT_VERTEX_BYTES   = CHUNK_SLOT_VERTICES * sizeof(Vertex);
+const vk::DeviceSize CHUNK_SLOT_BYTES          = CHUNK_SLOT_VERTEX_BYTES + CHUNK_SLOT_INDICES * sizeof(uint32_t);
+const uint32_t       CHUNK_SLOTS_PER_BLOCK     = 8;        // the heap grows and shrinks by blocks of slots
+const uint32_t       MAX_STREAMING_BLOCKS      = 64;
+const vk::DeviceSize STREAMING_UPLOAD_BYTES    = 8 << 20;        // per frame, bounds the copy time added to a frame
+const float          STREAMING_BUDGET_FRACTION = 0.5f;           // share of the device local budget the heap may use
+const uint32_t       MAX_PENDING_CHUNK_LOADS   = 16;
+
+// shape of the generated chunks written by --write-chunks
+const uint32_t GENERATED_CHUNK_RINGS    = 32;
+const uint32_t GENERATED_CHUNK_SEGMENTS = 128;
+
+struct ChunkData
+{
+	uint32_t              chunk;
+	std::vector<Vertex>   vertices;
+	std::vector<uint32_t> indices;
+	glm::vec4             boundingSphere;
+	MeshLods              lods;
+	std::string           error;        // set when the file could not be read
+};
+
+// one placement of a streamed chunk in the world
+struct ChunkInstance
+{
+	glm::mat4 model;
+	glm::vec4 tint;
+	uint32_t  chunk;
+	uint32_t  texture;        // index of a TEXTURE_DIRECTORY file, untextured when there is none
+	uint32_t  padding[2];
+};
+
+// where a resident chunk lives, vertices and indices are bound at these offsets
+struct ResidentChunk
+{
+	vk::Buffer     buffer;
+	vk::DeviceSize vertexOffset;
+	vk::DeviceSize indexOffset;
+	glm::vec4      boundingSphere;
+	MeshLods       lods;        // index ranges relative to indexOffset
+};
+
+struct StreamingStats
+{
+	uint64_t       hits           = 0;
+	uint64_t       misses         = 0;
+	uint64_t       evictions      = 0;
+	uint64_t       bytesStreamed  = 0;
+	double         bytesPerSecond = 0;        // over the last reporting interval
+	uint32_t       residentChunks = 0;
+	uint32_t       slots          = 0;
+	vk::DeviceSize heapBudget     = 0;        // device local heap, from VK_EXT_memory_budget when available
+	vk::DeviceSize heapUsage      = 0;
+};
+
+// simplifies the mesh into its levels of detail, so loading never does
+static void writeChunkFile(const std::string &path, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &meshIndices)
+{
+	std::vector<uint32_t> indices;
+	MeshLods              lods = generateLods(vertices, meshIndices, indices);
+
+	if (vertices.empty() || vertices.size() > CHUNK_SLOT_VERTICES || indices.size() > CHUNK_SLOT_INDICES)
+	{
+		throw std::runtime_error("chunk does not fit into a streaming slot!");
+	}
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		throw std::runtime_error("failed to open chunk file for writing!");
+	}
+
+	uint32_t  vertexCount    = static_cast<uint32_t>(vertices.size());
+	uint32_t  indexCount     = static_cast<uint32_t>(indices.size());
+	glm::vec4 boundingSphere = computeBoundingSphere(vertices);
+
+	file.write(CHUNK_MAGIC, sizeof(CHUNK_MAGIC));
+	file.write(reinterpret_cast<const char *>(&CHUNK_VERSION), sizeof(CHUNK_VERSION));
+	file.write(reinterpret_cast<const char *>(&vertexCount), sizeof(vertexCount));
+	file.write(reinterpret_cast<const char *>(&indexCount), sizeof(indexCount));
+	file.write(reinterpret_cast<const char *>(&boundingSphere), sizeof(boundingSphere));
+	file.write(reinterpret_cast<const char *>(&lods), sizeof(lods));
+	file.write(reinterpret_cast<const char *>(vertices.data()), sizeof(Vertex) * vertexCount);
+	file.write(reinterpret_cast<const char *>(indices.data()), sizeof(uint32_t) * indexCount);
+}
+
+// A disc with a wavy outline that differs per seed, dense enough for its
+// levels of detail to differ. Stands in for exported content.
+static void generateChunkMesh(uint32_t seed, std::vector<Vertex> &vertices, std::vector<uint32_t> &indices)
+{
+	std::minstd_rand                      random(seed + 1);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	float     waves = std::floor(3.0f + dist(random) * 6.0f);
+	float     phase = dist(random) * 6.2831853f;
+	glm::vec3 inner = {dist(random), dist(random), dist(random)};
+	glm::vec3 outer = {dist(random), dist(random), dist(random)};
+
+	vertices.clear();
+	indices.clear();
+	vertices.push_back({{0.0f, 0.0f}, inner, {0.5f, 0.5f}});
+	for (uint32_t ring = 1; ring <= GENERATED_CHUNK_RINGS; ring++)
+	{
+		float share = static_cast<float>(ring) / GENERATED_CHUNK_RINGS;
+		for (uint32_t segment = 0; segment < GENERATED_CHUNK_SEGMENTS; segment++)
+		{
+			float angle    = 6.2831853f * segment / GENERATED_CHUNK_SEGMENTS;
+			float radius   = share * (0.85f + 0.15f * std::sin(waves * angle + phase));
+			auto  position = glm::vec2(std::cos(angle), std::sin(angle)) * radius;
+			vertices.push_back({position, glm::mix(inner, outer, share), position * 0.5f + 0.5f});
+		}
+	}
+
+	// counter-clockwise like the built-in triangle
+	auto vertex = [](uint32_t ring, uint32_t segment) { return 1 + (ring - 1) * GENERATED_CHUNK_SEGMENTS + segment % GENERATED_CHUNK_SEGMENTS; };
+	for (uint32_t segment = 0; segment < GENERATED_CHUNK_SEGMENTS; segment++)
+	{
+		indices.insert(indices.end(), {0, vertex(1, segment), vertex(1, segment + 1)});
+		for (uint32_t ring = 1; ring < GENERATED_CHUNK_RINGS; ring++)
+		{
+			indices.insert(indices.end(), {vertex(ring, segment), vertex(ring + 1, segment), vertex(ring + 1, segment + 1)});
+			indices.insert(indices.end(), {vertex(ring, segment), vertex(ring + 1, segment + 1), vertex(ring, segment + 1)});
+		}
+	}
+}
+
+// The offline step behind --write-chunks: writes count generated chunks
+// into directory, numbered so that the streaming order matches.
+static void writeGeneratedChunks(const std::string &directory, uint32_t count)
+{
+	std::filesystem::create_directories(directory);
+
+	std::vector<Vertex>   vertices;
+	std::vector<uint32_t> indices;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "chunk%06u%s", i, CHUNK_EXTENSION);
+
+		generateChunkMesh(i, vertices, indices);
+		writeChunkFile((std::filesystem::path(directory) / name).string(), vertices, indices);
+	}
+}
+
+// every *.chunk file in directory, sorted by name, empty when there is no directory
+static std::vector<std::string> listChunkFiles(const std::string &directory)
+{
+	std::vector<std::string> paths;
+	std::error_code          error;
+	if (std::filesystem::is_directory(directory, error))
+	{
+		for (const auto &entry : std::filesystem::directory_iterator(directory))
+		{
+			if (entry.path().extension() == CHUNK_EXTENSION)
+			{
+				paths.push_back(entry.path().string());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+	}
+	return paths;
+}
+
+// everything before the vertices, enough to cull a chunk that is not loaded
+static void readChunkHeader(std::ifstream &file, ChunkData &data, uint32_t &vertexCount, uint32_t &indexCount)
+{
+	char     magic[sizeof(CHUNK_MAGIC)];
+	uint32_t version;
+
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char *>(&version), sizeof(version));
+	file.read(reinterpret_cast<char *>(&vertexCount), sizeof(vertexCount));
+	file.read(reinterpret_cast<char *>(&indexCount), sizeof(indexCount));
+	file.read(reinterpret_cast<char *>(&data.boundingSphere), sizeof(data.boundingSphere));
+	file.read(reinterpret_cast<char *>(&data.lods), sizeof(data.lods));
+
+	if (!file || std::memcmp(magic, CHUNK_MAGIC, sizeof(magic)) != 0 || version != CHUNK_VERSION)
+	{
+		throw std::runtime_error("not a chunk file!");
+	}
+	if (vertexCount > CHUNK_SLOT_VERTICES || indexCount > CHUNK_SLOT_INDICES)
+	{
+		throw std::runtime_error("chunk does not fit into a streaming slot!");
+	}
+
+	// a bad table would draw outside the slot
+	if (data.lods.levelCount == 0 || data.lods.levelCount > MAX_LOD_LEVELS)
+	{
+		throw std::runtime_error("chunk file has no levels of detail!");
+	}
+	for (uint32_t i = 0; i < data.lods.levelCount; i++)
+	{
+		auto &level = data.lods.levels[i];
+		if (level.firstIndex > indexCount || level.indexCount > indexCount - level.firstIndex)
+		{
+			throw std::runtime_error("chunk level of detail is out of range!");
+		}
+	}
+}
+
+static ChunkData readChunkFile(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+	{
+		throw std::runtime_error("failed to open chunk file!");
+	}
+
+	ChunkData data;
+	uint32_t  vertexCount, indexCount;
+	readChunkHeader(file, data, vertexCount, indexCount);
+
+	data.vertices.resize(vertexCount);
+	data.indices.resize(indexCount);
+	file.read(reinterpret_cast<char *>(data.vertices.data()), sizeof(Vertex) * vertexCount);
+	file.read(reinterpret_cast<char *>(data.indices.data()), sizeof(uint32_t) * indexCount);
+
+	if (!file)
+	{
+		throw std::runtime_error("chunk file is truncated!");
+	}
+
+	return data;
+}
+
+// Streams mesh chunks from disk into a gpu heap of fixed-size slots. Files
+// are read by background jobs and copied in from a per-frame staging
+// buffer, so the frame never waits on i/o; a chunk that is not resident yet
+// is simply not drawn. When no slot is free, the least recently requested
+// chunk that the current frame does not use is evicted. The heap grows in
+// blocks while the device local budget allows it and gives blocks back when
+// the budget shrinks.
+class ResidencyManager
+{
+  public:
+	// every *.chunk file in directory becomes a chunk, sorted by name
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device, JobSystem &jobs, const std::string &directory, uint32_t framesInFlight)
+	{
+		this->physicalDevice = physicalDevice;
+		this->device         = device;
+		this->jobs           = &jobs;
+		memoryBudget         = DeviceHelpers::isExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+		chunkPaths = listChunkFiles(directory);
+		chunks.resize(chunkPaths.size());
+
+		if (chunkPaths.empty())
+		{
+			return;
+		}
+
+		// the bounds are read up front, so chunks are culled before they are loaded
+		for (uint32_t i = 0; i < chunks.size(); i++)
+		{
+			try
+			{
+				std::ifstream file(chunkPaths[i], std::ios::binary);
+				ChunkData     header;
+				uint32_t      vertexCount, indexCount;
+				readChunkHeader(file, header, vertexCount, indexCount);
+				chunks[i].boundingSphere = header.boundingSphere;
+			}
+			catch (const std::exception &e)
+			{
+				std::cout << "Failed to stream " << chunkPaths[i] << ": " << e.what() << "\n";
+				chunks[i].state = ChunkState::Failed;
+			}
+		}
+
+		staging.resize(framesInFlight);
+		for (auto &frameStaging : staging)
+		{
+			frameStaging.buffer = device.createBuffer(vk::BufferCreateInfo({}, STREAMING_UPLOAD_BYTES, vk::BufferUsageFlagBits::eTransferSrc));
+			frameStaging.memory = allocate(frameStaging.buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+			frameStaging.mapped = static_cast<char *>(device.mapMemory(frameStaging.memory, 0, STREAMING_UPLOAD_BYTES));
+		}
+
+		refreshBudget();
+		lastReport = std::chrono::steady_clock::now();
+
+		std::cout << "Streaming " << chunkPaths.size() << " chunks from " << directory << "\n";
+	}
+
+	// waits for loads still running, their jobs point at this object
+	void destroy()
+	{
+		while (pendingLoads > 0)
+		{
+			ChunkData *data;
+			while (finishedLoads.tryPop(data))
+			{
+				delete (data);
+				pendingLoads--;
+			}
+			std::this_thread::yield();
+		}
+
+		for (auto &block : blocks)
+		{
+			destroyBlock(block);
+		}
+		for (auto &retired : retiredBlocks)
+		{
+			destroyBlock(retired.block);
+		}
+		for (auto &frameStaging : staging)
+		{
+			device.unmapMemory(frameStaging.memory);
+			device.destroyBuffer(frameStaging.buffer);
+			GpuMemory::free(device, frameStaging.memory);
+		}
+	}
+
+	uint32_t chunkCount() const
+	{
+		return static_cast<uint32_t>(chunks.size());
+	}
+
+	// Call once per frame after the frame's fence has signaled, before
+	// requesting chunks. Takes finished loads and frees retired blocks.
+	void beginFrame(uint32_t frame)
+	{
+		if (chunks.empty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("streaming beginFrame");
+
+		frameNumber++;
+		currentFrame = frame;
+
+		ChunkData *data;
+		while (finishedLoads.tryPop(data))
+		{
+			pendingLoads--;
+			auto &chunk = chunks[data->chunk];
+			if (!data->error.empty())
+			{
+				std::cout << "Failed to stream " << chunkPaths[data->chunk] << ": " << data->error << "\n";
+				chunk.state = ChunkState::Failed;
+				delete (data);
+				continue;
+			}
+
+			chunk.state = ChunkState::Loaded;
+			chunk.data.reset(data);
+			uploadQueue.push_back(data->chunk);
+		}
+
+		// a retired block may still be read by frames in flight until they finish
+		while (!retiredBlocks.empty() && retiredBlocks.front().frame + staging.size() < frameNumber)
+		{
+			destroyBlock(retiredBlocks.front().block);
+			retiredBlocks.pop_front();
+		}
+
+		auto now     = std::chrono::steady_clock::now();
+		auto elapsed = std::chrono::duration<double>(now - lastReport).count();
+		if (elapsed >= 1.0)
+		{
+			bool active             = counters.bytesStreamed != bytesAtLastReport || counters.misses != missesAtLastReport;
+			counters.bytesPerSecond = (counters.bytesStreamed - bytesAtLastReport) / elapsed;
+			bytesAtLastReport       = counters.bytesStreamed;
+			missesAtLastReport      = counters.misses;
+			lastReport              = now;
+			refreshBudget();
+
+			if (active)
+			{
+				report();
+			}
+		}
+	}
+
+	// object space bounds from the file header, known before the chunk is loaded
+	const glm::vec4 &boundingSphere(uint32_t chunkIndex) const
+	{
+		return chunks[chunkIndex].boundingSphere;
+	}
+
+	// Marks the chunk as used this frame, protecting it from eviction, and
+	// returns it when it is resident. Otherwise starts loading it and
+	// returns nullptr. Call before recordUploads for every chunk the frame
+	// draws.
+	const ResidentChunk *request(uint32_t chunkIndex)
+	{
+		auto &chunk    = chunks[chunkIndex];
+		chunk.lastUsed = frameNumber;
+
+		if (chunk.state == ChunkState::Resident)
+		{
+			counters.hits++;
+			return &chunk.resident;
+		}
+
+		counters.misses++;
+		if (chunk.state == ChunkState::Unloaded && pendingLoads < MAX_PENDING_CHUNK_LOADS)
+		{
+			chunk.state = ChunkState::Loading;
+			pendingLoads++;
+
+			auto path = chunkPaths[chunkIndex];
+			jobs->runBackground(jobs->create("load chunk", [this, chunkIndex, path] {
+				auto data = new ChunkData();
+				try
+				{
+					*data = readChunkFile(path);
+				}
+				catch (const std::exception &e)
+				{
+					data->error = e.what();
+				}
+				data->chunk = chunkIndex;
+				finishedLoads.push(data);
+			}));
+		}
+		return nullptr;
+	}
+
+	// the chunk when it is resident, without marking it as used
+	const ResidentChunk *resident(uint32_t chunkIndex) const
+	{
+		auto &chunk = chunks[chunkIndex];
+		return chunk.state == ChunkState::Resident ? &chunk.resident : nullptr;
+	}
+
+	// Copies loaded chunks into free or evicted slots. Must be recorded
+	// before the draws of the frame; the barriers order the copies after
+	// earlier frames' reads of the slots and before this frame's reads.
+	void recordUploads(vk::CommandBuffer commandBuffer)
+	{
+		if (uploadQueue.empty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("streaming uploads");
+
+		auto                                              &frameStaging  = staging[currentFrame];
+		vk::DeviceSize                                     stagingOffset = 0;
+		std::vector<std::pair<vk::Buffer, vk::BufferCopy>> copies;
+
+		while (!uploadQueue.empty())
+		{
+			auto &chunk = chunks[uploadQueue.front()];
+
+			// evicted or failed since the load finished
+			if (chunk.state != ChunkState::Loaded)
+			{
+				uploadQueue.pop_front();
+				continue;
+			}
+
+			auto vertexBytes = sizeof(Vertex) * chunk.data->vertices.size();
+			auto indexBytes  = sizeof(uint32_t) * chunk.data->indices.size();
+			if (stagingOffset + vertexBytes + indexBytes > STREAMING_UPLOAD_BYTES)
+			{
+				break;
+			}
+
+			uint32_t slot;
+			if (!acquireSlot(slot))
+			{
+				break;
+			}
+
+			auto &block      = blocks[slot / CHUNK_SLOTS_PER_BLOCK];
+			auto  slotOffset = (slot % CHUNK_SLOTS_PER_BLOCK) * CHUNK_SLOT_BYTES;
+
+			std::memcpy(frameStaging.mapped + stagingOffset, chunk.data->vertices.data(), vertexBytes);
+			std::memcpy(frameStaging.mapped + stagingOffset + vertexBytes, chunk.data->indices.data(), indexBytes);
+			copies.push_back({block.buffer, vk::BufferCopy(stagingOffset, slotOffset, vertexBytes)});
+			copies.push_back({block.buffer, vk::BufferCopy(stagingOffset + vertexBytes, slotOffset + CHUNK_SLOT_VERTEX_BYTES, indexBytes)});
+			stagingOffset += vertexBytes + indexBytes;
+
+			chunk.state                   = ChunkState::Resident;
+			chunk.slot                    = slot;
+			chunk.resident.buffer         = block.buffer;
+			chunk.resident.vertexOffset   = slotOffset;
+			chunk.resident.indexOffset    = slotOffset + CHUNK_SLOT_VERTEX_BYTES;
+			chunk.resident.boundingSphere = chunk.data->boundingSphere;
+			chunk.resident.lods           = chunk.data->lods;
+			chunk.data.reset();
+			slotOwners[slot] = uploadQueue.front();
+			uploadQueue.pop_front();
+
+			counters.bytesStreamed += vertexBytes + indexBytes;
+		}
+
+		if (copies.empty())
+		{
+			return;
+		}
+
+		// write after read on slots that earlier frames drew from
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eVertexInput, vk::PipelineStageFlagBits::eTransfer, {}, nullptr, nullptr, nullptr);
+
+		for (const auto &copy : copies)
+		{
+			commandBuffer.copyBuffer(frameStaging.buffer, copy.first, copy.second);
+		}
+
+		auto barrier          = vk::MemoryBarrier();
+		barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+		barrier.dstAccessMask = vk::AccessFlagBits::eVertexAttributeRead | vk::AccessFlagBits::eIndexRead;
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eVertexInput, {}, barrier, nullptr, nullptr);
+	}
+
+	StreamingStats stats() const
+	{
+		auto result           = counters;
+		result.slots          = static_cast<uint32_t>(blocks.size()) * CHUNK_SLOTS_PER_BLOCK;
+		result.residentChunks = static_cast<uint32_t>(std::count_if(slotOwners.begin(), slotOwners.end(), [](uint32_t owner) { return owner != NO_CHUNK; }));
+		return result;
+	}
+
+  private:
+	static const uint32_t NO_CHUNK = UINT32_MAX;
+
+	enum class ChunkState
+	{
+		Unloaded,
+		Loading,
+		Loaded,        // in memory, waiting for a slot and staging space
+		Resident,
+		Failed
+	};
+
+	struct Chunk
+	{
+		ChunkState                 state    = ChunkState::Unloaded;
+		uint32_t                   slot     = 0;
+		uint64_t                   lastUsed = 0;
+		glm::vec4                  boundingSphere;
+		ResidentChunk              resident;
+		std::unique_ptr<ChunkData> data;
+	};
+
+	struct Block
+	{
+		vk::Buffer       buffer;
+		vk::DeviceMemory memory;
+	};
+
+	struct RetiredBlock
+	{
+		Block    block;
+		uint64_t frame;
+	};
+
+	struct Staging
+	{
+		vk::Buffer       buffer;
+		vk::DeviceMemory memory;
+		char            *mapped;
+	};
+
+	vk::PhysicalDevice physicalDevice;
+	vk::Device         device;
+	JobSystem         *jobs;
+	bool               memoryBudget;
+
+	std::vector<std::string>    chunkPaths;
+	std::vector<Chunk>          chunks;
+	std::vector<Block>          blocks;
+	std::deque<RetiredBlock>    retiredBlocks;
+	std::vector<uint32_t>       slotOwners;
+	std::vector<Staging>        staging;
+	std::deque<uint32_t>        uploadQueue;
+	MpscQueue<ChunkData *, 256> finishedLoads;
+	uint32_t                    pendingLoads = 0;
+	uint64_t                    frameNumber  = 0;
+	uint32_t                    currentFrame = 0;
+
+	StreamingStats                        counters;
+	uint64_t                              bytesAtLastReport  = 0;
+	uint64_t                              missesAtLastReport = 0;
+	std::chrono::steady_clock::time_point lastReport;
+
+	void report() const
+	{
+		auto current = stats();
+		std::cout << "Streaming: " << current.hits << " hits, " << current.misses << " misses, " << current.evictions << " evictions, "
+		          << current.bytesPerSecond / (1 << 20) << " MiB/s, " << current.residentChunks << "/" << current.slots << " slots, heap "
+		          << (current.heapUsage >> 20) << "/" << (current.heapBudget >> 20) << " MiB\n";
+	}
+
+	// a free slot, a new block when the budget allows, or the least recently used slot
+	bool acquireSlot(uint32_t &slot)
+	{
+		for (uint32_t i = 0; i < slotOwners.size(); i++)
+		{
+			if (slotOwners[i] == NO_CHUNK)
+			{
+				slot = i;
+				return true;
+			}
+		}
+
+		if (blocks.size() < MAX_STREAMING_BLOCKS &&
+		    counters.heapUsage + CHUNK_SLOT_BYTES * CHUNK_SLOTS_PER_BLOCK <= counters.heapBudget * STREAMING_BUDGET_FRACTION)
+		{
+			addBlock();
+			slot = static_cast<uint32_t>(slotOwners.size()) - CHUNK_SLOTS_PER_BLOCK;
+			return true;
+		}
+
+		uint64_t oldest = frameNumber;
+		for (uint32_t i = 0; i < slotOwners.size(); i++)
+		{
+			if (chunks[slotOwners[i]].lastUsed < oldest)
+			{
+				oldest = chunks[slotOwners[i]].lastUsed;
+				slot   = i;
+			}
+		}
+
+		// every resident chunk is requested this frame
+		if (oldest == frameNumber)
+		{
+			return false;
+		}
+
+		evict(slot);
+		return true;
+	}
+
+	void evict(uint32_t slot)
+	{
+		chunks[slotOwners[slot]].state = ChunkState::Unloaded;
+		slotOwners[slot]               = NO_CHUNK;
+		counters.evictions++;
+	}
+
+	void addBlock()
+	{
+		Block block;
+		auto  usage  = vk::BufferUsageFlagBits::eVertexBuffer | vk::BufferUsageFlagBits::eIndexBuffer | vk::BufferUsageFlagBits::eTransferDst;
+		block.buffer = device.createBuffer(vk::BufferCreateInfo({}, CHUNK_SLOT_BYTES * CHUNK_SLOTS_PER_BLOCK, usage));
+		block.memory = allocate(block.buffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
+
+		blocks.push_back(block);
+		slotOwners.resize(slotOwners.size() + CHUNK_SLOTS_PER_BLOCK, NO_CHUNK);
+		counters.heapUsage += CHUNK_SLOT_BYTES * CHUNK_SLOTS_PER_BLOCK;
+	}
+
+	// gives the last block back, its memory is freed once no frame in flight can read it
+	void removeBlock()
+	{
+		for (uint32_t i = 0; i < CHUNK_SLOTS_PER_BLOCK; i++)
+		{
+			uint32_t slot = static_cast<uint32_t>(slotOwners.size()) - 1;
+			if (slotOwners[slot] != NO_CHUNK)
+			{
+				evict(slot);
+			}
+			slotOwners.pop_back();
+		}
+
+		retiredBlocks.push_back({blocks.back(), frameNumber});
+		blocks.pop_back();
+	}
+
+	void destroyBlock(const Block &block)
+	{
+		device.destroyBuffer(block.buffer);
+		GpuMemory::free(device, block.memory);
+	}
+
+	vk::DeviceMemory allocate(vk::Buffer buffer, vk::MemoryPropertyFlags properties)
+	{
+		auto requirements = device.getBufferMemoryRequirements(buffer);
+		auto memoryIndex  = DeviceHelpers::findMemoryType(physicalDevice, requirements.memoryTypeBits, properties);
+		auto memory       = GpuMemory::allocate(device, vk::MemoryAllocateInfo(requirements.size, memoryIndex));
+		device.bindBufferMemory(buffer, memory, 0);
+		return memory;
+	}
+
+	// Budget and usage of the largest device local heap. The budget covers
+	// other processes too, so it can drop while we run; blocks are given back
+	// until the heap fits again.
+	void refreshBudget()
+	{
+		auto heaps = physicalDevice.getMemoryProperties();
+
+		uint32_t heap = 0;
+		for (uint32_t i = 0; i < heaps.memoryHeapCount; i++)
+		{
+			if ((heaps.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal) && heaps.memoryHeaps[i].size > heaps.memoryHeaps[heap].size)
+			{
+				heap = i;
+			}
+		}
+
+		if (memoryBudget)
+		{
+			auto  properties    = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2, vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+			auto &budget        = properties.get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+			counters.heapBudget = budget.heapBudget[heap];
+			counters.heapUsage  = budget.heapUsage[heap];
+		}
+		else
+		{
+			// without the extension only our own blocks are known
+			counters.heapBudget = heaps.memoryHeaps[heap].size;
+			counters.heapUsage  = CHUNK_SLOT_BYTES * CHUNK_SLOTS_PER_BLOCK * blocks.size();
+		}
+
+		while (!blocks.empty() && counters.heapUsage > counters.heapBudget)
+		{
+			removeBlock();
+			counters.heapUsage -= CHUNK_SLOT_BYTES * CHUNK_SLOTS_PER_BLOCK;
+		}
+	}
+};
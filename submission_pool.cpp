@@ -0,0 +1,268 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <deque>
+#include <stdexcept>
+#include <vector>
+
+#include "profiler.cpp"
+
+// identifies a submission made through a SubmissionPool, 0 is never used
+using SubmissionTicket = uint64_t;
+
+struct SubmissionPoolStats
+{
+	uint32_t liveFences;
+	uint32_t freeFences;
+	uint32_t liveSemaphores;
+	uint32_t freeSemaphores;
+	uint32_t liveCommandBuffers;
+	uint32_t freeCommandBuffers;
+	uint32_t pendingSubmissions;
+};
+
+// Recycles fences, binary semaphores and one-shot command buffers for one
+// queue, so the frame, async compute and extra submissions (uploads,
+// readbacks, calibration) do not create and destroy Vulkan objects every
+// time. A submission's command buffer and fence go back to the free lists
+// once the fence has signaled, found by collect() or wait(). Submissions on
+// one queue complete in order, so a ticket is complete once every older one
+// is. Not thread safe, it is used from the render thread only.
+class SubmissionPool
+{
+  public:
+	void create(vk::Device device, vk::Queue queue, uint32_t queueFamily)
+	{
+		this->device = device;
+		this->queue  = queue;
+
+		auto poolInfo             = vk::CommandPoolCreateInfo();
+		poolInfo.flags            = vk::CommandPoolCreateFlagBits::eTransient | vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
+		poolInfo.queueFamilyIndex = queueFamily;
+		commandPool               = device.createCommandPool(poolInfo);
+	}
+
+	// destroys every object the pool created, including ones still handed out
+	void destroy()
+	{
+		if (!commandPool)
+		{
+			return;
+		}
+
+		while (!pending.empty())
+		{
+			wait(pending.back().ticket);
+		}
+
+		for (auto fence : fences)
+		{
+			device.destroyFence(fence);
+		}
+		for (auto semaphore : semaphores)
+		{
+			device.destroySemaphore(semaphore);
+		}
+		device.destroyCommandPool(commandPool);
+		commandPool = nullptr;
+	}
+
+	// unsignaled unless asked otherwise, signaled fences are always new
+	vk::Fence acquireFence(bool signaled = false)
+	{
+		if (!signaled && !freeFences.empty())
+		{
+			auto fence = freeFences.back();
+			freeFences.pop_back();
+			return fence;
+		}
+
+		auto fenceInfo = vk::FenceCreateInfo(signaled ? vk::FenceCreateFlagBits::eSignaled : vk::FenceCreateFlags());
+		auto fence     = device.createFence(fenceInfo);
+		fences.push_back(fence);
+		return fence;
+	}
+
+	// no submission may still use the fence
+	void releaseFence(vk::Fence fence)
+	{
+		device.resetFences(fence);
+		freeFences.push_back(fence);
+	}
+
+	vk::Semaphore acquireSemaphore()
+	{
+		if (!freeSemaphores.empty())
+		{
+			auto semaphore = freeSemaphores.back();
+			freeSemaphores.pop_back();
+			return semaphore;
+		}
+
+		auto semaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+		semaphores.push_back(semaphore);
+		return semaphore;
+	}
+
+	// A binary semaphore is unsignaled again once the wait on it has
+	// completed, so it is only reused once the ticket of the submission that
+	// waits on it has completed, even if that ticket is not submitted yet.
+	// Without a ticket it must not be pending at all.
+	void releaseSemaphore(vk::Semaphore semaphore, SubmissionTicket after = 0)
+	{
+		if (after <= completedTicket)
+		{
+			freeSemaphores.push_back(semaphore);
+			return;
+		}
+		deferredSemaphores.push_back({after, semaphore});
+	}
+
+	// a primary command buffer in the recording state, submitted once with submit()
+	vk::CommandBuffer beginCommands()
+	{
+		vk::CommandBuffer commandBuffer;
+		if (!freeCommandBuffers.empty())
+		{
+			commandBuffer = freeCommandBuffers.back();
+			freeCommandBuffers.pop_back();
+			commandBuffer.reset();
+		}
+		else
+		{
+			auto allocInfo               = vk::CommandBufferAllocateInfo();
+			allocInfo.commandPool        = commandPool;
+			allocInfo.level              = vk::CommandBufferLevel::ePrimary;
+			allocInfo.commandBufferCount = 1;
+			commandBuffer                = device.allocateCommandBuffers(allocInfo)[0];
+			commandBufferCount++;
+		}
+
+		commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+		return commandBuffer;
+	}
+
+	// ends and submits a command buffer from beginCommands(), with a fence from the pool
+	SubmissionTicket submit(vk::CommandBuffer commandBuffer, const std::vector<vk::Semaphore> &waits = {},
+	                        const std::vector<vk::PipelineStageFlags> &waitStages = {}, const std::vector<vk::Semaphore> &signals = {})
+	{
+		if (waits.size() != waitStages.size())
+		{
+			throw std::runtime_error("every wait semaphore needs a stage!");
+		}
+
+		commandBuffer.end();
+
+		auto submitInfo                 = vk::SubmitInfo();
+		submitInfo.waitSemaphoreCount   = static_cast<uint32_t>(waits.size());
+		submitInfo.pWaitSemaphores      = waits.data();
+		submitInfo.pWaitDstStageMask    = waitStages.data();
+		submitInfo.commandBufferCount   = 1;
+		submitInfo.pCommandBuffers      = &commandBuffer;
+		submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signals.size());
+		submitInfo.pSignalSemaphores    = signals.data();
+
+		auto fence = acquireFence();
+		queue.submit(submitInfo, fence);
+
+		pending.push_back({++lastTicket, fence, commandBuffer});
+		return lastTicket;
+	}
+
+	// recycles the objects of every completed submission, call once per frame
+	void collect()
+	{
+		while (!pending.empty() && device.getFenceStatus(pending.front().fence) == vk::Result::eSuccess)
+		{
+			retire();
+		}
+	}
+
+	bool isComplete(SubmissionTicket ticket)
+	{
+		collect();
+		return ticket <= completedTicket;
+	}
+
+	void wait(SubmissionTicket ticket)
+	{
+		PROFILE_ZONE("wait for submission");
+
+		while (!pending.empty() && pending.front().ticket <= ticket)
+		{
+			if (device.waitForFences(pending.front().fence, true, UINT64_MAX) != vk::Result::eSuccess)
+			{
+				throw std::runtime_error("failed to wait for a submission!");
+			}
+			retire();
+		}
+	}
+
+	SubmissionPoolStats stats() const
+	{
+		auto stats               = SubmissionPoolStats();
+		stats.freeFences         = static_cast<uint32_t>(freeFences.size());
+		stats.liveFences         = static_cast<uint32_t>(fences.size()) - stats.freeFences;
+		stats.freeSemaphores     = static_cast<uint32_t>(freeSemaphores.size());
+		stats.liveSemaphores     = static_cast<uint32_t>(semaphores.size()) - stats.freeSemaphores;
+		stats.freeCommandBuffers = static_cast<uint32_t>(freeCommandBuffers.size());
+		stats.liveCommandBuffers = commandBufferCount - stats.freeCommandBuffers;
+		stats.pendingSubmissions = static_cast<uint32_t>(pending.size());
+		return stats;
+	}
+
+  private:
+	struct Submission
+	{
+		SubmissionTicket  ticket;
+		vk::Fence         fence;
+		vk::CommandBuffer commandBuffer;
+	};
+
+	struct DeferredSemaphore
+	{
+		SubmissionTicket after;
+		vk::Semaphore    semaphore;
+	};
+
+	vk::Device                     device;
+	vk::Queue                      queue;
+	vk::CommandPool                commandPool;
+	std::vector<vk::Fence>         fences;        // every fence and semaphore created, for destroy()
+	std::vector<vk::Semaphore>     semaphores;
+	uint32_t                       commandBufferCount = 0;
+	std::vector<vk::Fence>         freeFences;
+	std::vector<vk::Semaphore>     freeSemaphores;
+	std::vector<DeferredSemaphore> deferredSemaphores;        // released before their ticket completed
+	std::vector<vk::CommandBuffer> freeCommandBuffers;
+	std::deque<Submission>         pending;
+	SubmissionTicket               lastTicket      = 0;
+	SubmissionTicket               completedTicket = 0;
+
+	// the oldest pending submission has completed
+	void retire()
+	{
+		auto &submission = pending.front();
+		device.resetFences(submission.fence);
+		freeFences.push_back(submission.fence);
+		freeCommandBuffers.push_back(submission.commandBuffer);
+		completedTicket = submission.ticket;
+		pending.pop_front();
+
+		for (size_t i = 0; i < deferredSemaphores.size();)
+		{
+			if (deferredSemaphores[i].after <= completedTicket)
+			{
+				freeSemaphores.push_back(deferredSemaphores[i].semaphore);
+				deferredSemaphores[i] = deferredSemaphores.back();
+				deferredSemaphores.pop_back();
+			}
+			else
+			{
+				i++;
+			}
+		}
+	}
+};
@@ -0,0 +1,910 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "descriptors.cpp"
+#include "device_helpers.cpp"
+#include "gpu_memory.cpp"
+#include "jobs.cpp"
+#include "profiler.cpp"
+#include "render_queue.cpp"
+
+// *.ktx2 files in this directory are streamed, sorted by name
+const char *TEXTURE_DIRECTORY = "textures";
+const char *TEXTURE_EXTENSION = ".ktx2";
+
+const char KTX2_IDENTIFIER[12] = {'\xAB', 'K', 'T', 'X', ' ', '2', '0', '\xBB', '\r', '\n', '\x1A', '\n'};
+
+const vk::DeviceSize TEXTURE_UPLOAD_BYTES      = 4 << 20;        // per frame, large levels are copied in bands of rows
+const uint32_t       MAX_PENDING_TEXTURE_LOADS = 8;
+const float          TEXTURE_MAX_ANISOTROPY    = 8.0f;
+
+// texel blocks of the formats we load, uncompressed formats have 1x1 blocks
+struct FormatBlock
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t bytes;
+	bool     compressed;
+};
+
+// false for formats we do not load
+static bool getFormatBlock(vk::Format format, FormatBlock &block)
+{
+	switch (format)
+	{
+		case vk::Format::eR8G8B8A8Unorm:
+		case vk::Format::eR8G8B8A8Srgb:
+		case vk::Format::eB8G8R8A8Unorm:
+		case vk::Format::eB8G8R8A8Srgb:
+			block = {1, 1, 4, false};
+			return true;
+		case vk::Format::eBc1RgbUnormBlock:
+		case vk::Format::eBc1RgbSrgbBlock:
+		case vk::Format::eBc1RgbaUnormBlock:
+		case vk::Format::eBc1RgbaSrgbBlock:
+		case vk::Format::eBc4UnormBlock:
+		case vk::Format::eBc4SnormBlock:
+			block = {4, 4, 8, true};
+			return true;
+		case vk::Format::eBc2UnormBlock:
+		case vk::Format::eBc2SrgbBlock:
+		case vk::Format::eBc3UnormBlock:
+		case vk::Format::eBc3SrgbBlock:
+		case vk::Format::eBc5UnormBlock:
+		case vk::Format::eBc5SnormBlock:
+		case vk::Format::eBc6HUfloatBlock:
+		case vk::Format::eBc6HSfloatBlock:
+		case vk::Format::eBc7UnormBlock:
+		case vk::Format::eBc7SrgbBlock:
+			block = {4, 4, 16, true};
+			return true;
+		default:
+			break;
+	}
+
+	// astc blocks are always 16 bytes, only their footprint differs
+	struct AstcFootprint
+	{
+		vk::Format unorm;
+		vk::Format srgb;
+		uint32_t   width;
+		uint32_t   height;
+	};
+	static const AstcFootprint footprints[] = {
+	    {vk::Format::eAstc4x4UnormBlock, vk::Format::eAstc4x4SrgbBlock, 4, 4},
+	    {vk::Format::eAstc5x4UnormBlock, vk::Format::eAstc5x4SrgbBlock, 5, 4},
+	    {vk::Format::eAstc5x5UnormBlock, vk::Format::eAstc5x5SrgbBlock, 5, 5},
+	    {vk::Format::eAstc6x5UnormBlock, vk::Format::eAstc6x5SrgbBlock, 6, 5},
+	    {vk::Format::eAstc6x6UnormBlock, vk::Format::eAstc6x6SrgbBlock, 6, 6},
+	    {vk::Format::eAstc8x5UnormBlock, vk::Format::eAstc8x5SrgbBlock, 8, 5},
+	    {vk::Format::eAstc8x6UnormBlock, vk::Format::eAstc8x6SrgbBlock, 8, 6},
+	    {vk::Format::eAstc8x8UnormBlock, vk::Format::eAstc8x8SrgbBlock, 8, 8},
+	    {vk::Format::eAstc10x5UnormBlock, vk::Format::eAstc10x5SrgbBlock, 10, 5},
+	    {vk::Format::eAstc10x6UnormBlock, vk::Format::eAstc10x6SrgbBlock, 10, 6},
+	    {vk::Format::eAstc10x8UnormBlock, vk::Format::eAstc10x8SrgbBlock, 10, 8},
+	    {vk::Format::eAstc10x10UnormBlock, vk::Format::eAstc10x10SrgbBlock, 10, 10},
+	    {vk::Format::eAstc12x10UnormBlock, vk::Format::eAstc12x10SrgbBlock, 12, 10},
+	    {vk::Format::eAstc12x12UnormBlock, vk::Format::eAstc12x12SrgbBlock, 12, 12}};
+
+	for (const auto &footprint : footprints)
+	{
+		if (format == footprint.unorm || format == footprint.srgb)
+		{
+			block = {footprint.width, footprint.height, 16, true};
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool isAstcFormat(vk::Format format)
+{
+	return format >= vk::Format::eAstc4x4UnormBlock && format <= vk::Format::eAstc12x12SrgbBlock;
+}
+
+struct TextureLevel
+{
+	vk::DeviceSize offset;        // in TextureData::bytes
+	vk::DeviceSize size;
+	uint32_t       width;
+	uint32_t       height;
+};
+
+struct TextureData
+{
+	uint32_t                  texture;
+	vk::Format                format;
+	FormatBlock               block;
+	std::vector<TextureLevel> levels;               // largest first
+	bool                      generateMips;         // the file asks for mips to be generated, only levels[0] is stored
+	std::vector<char>         bytes;
+	std::string               error;                // set when the file could not be read
+};
+
+// Reads a 2D KTX2 file without supercompression. Levels are kept in the
+// file's bytes, the level index says where each one is.
+static TextureData readKtx2File(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+	{
+		throw std::runtime_error("failed to open texture file!");
+	}
+
+	TextureData data;
+	data.bytes.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(data.bytes.data(), data.bytes.size());
+	if (!file)
+	{
+		throw std::runtime_error("failed to read texture file!");
+	}
+
+	// identifier, 9 uint32 header fields, 4 uint32 and 2 uint64 index fields
+	const size_t headerSize = sizeof(KTX2_IDENTIFIER) + 9 * sizeof(uint32_t) + 4 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+	if (data.bytes.size() < headerSize || std::memcmp(data.bytes.data(), KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0)
+	{
+		throw std::runtime_error("not a ktx2 file!");
+	}
+
+	auto read32 = [&](size_t offset) {
+		uint32_t value;
+		std::memcpy(&value, data.bytes.data() + offset, sizeof(value));
+		return value;
+	};
+	auto read64 = [&](size_t offset) {
+		uint64_t value;
+		std::memcpy(&value, data.bytes.data() + offset, sizeof(value));
+		return value;
+	};
+
+	size_t   field      = sizeof(KTX2_IDENTIFIER);
+	uint32_t vkFormat   = read32(field);
+	uint32_t width      = read32(field + 8);
+	uint32_t height     = read32(field + 12);
+	uint32_t depth      = read32(field + 16);
+	uint32_t layers     = read32(field + 20);
+	uint32_t faces      = read32(field + 24);
+	uint32_t levelCount = read32(field + 28);
+	uint32_t scheme     = read32(field + 32);
+
+	if (scheme != 0)
+	{
+		throw std::runtime_error("supercompressed ktx2 files are not supported!");
+	}
+	if (width == 0 || height == 0 || depth > 1 || layers > 1 || faces != 1)
+	{
+		throw std::runtime_error("only single 2d ktx2 images are supported!");
+	}
+
+	data.format = static_cast<vk::Format>(vkFormat);
+	if (!getFormatBlock(data.format, data.block))
+	{
+		throw std::runtime_error("unsupported ktx2 texture format!");
+	}
+
+	data.generateMips = levelCount == 0;
+	levelCount        = std::max(levelCount, 1u);
+	if (levelCount > 32 || (std::max(width, height) >> (levelCount - 1)) == 0)
+	{
+		throw std::runtime_error("ktx2 file has too many levels!");
+	}
+
+	size_t levelIndex = headerSize;
+	if (data.bytes.size() < levelIndex + levelCount * 3 * sizeof(uint64_t))
+	{
+		throw std::runtime_error("ktx2 file is truncated!");
+	}
+
+	for (uint32_t i = 0; i < levelCount; i++)
+	{
+		TextureLevel level;
+		level.offset = read64(levelIndex + i * 3 * sizeof(uint64_t));
+		level.size   = read64(levelIndex + i * 3 * sizeof(uint64_t) + sizeof(uint64_t));
+		level.width  = std::max(width >> i, 1u);
+		level.height = std::max(height >> i, 1u);
+
+		vk::DeviceSize expected = vk::DeviceSize((level.width + data.block.width - 1) / data.block.width) *
+		                          ((level.height + data.block.height - 1) / data.block.height) * data.block.bytes;
+		if (level.size != expected || level.offset > data.bytes.size() || level.size > data.bytes.size() - level.offset)
+		{
+			throw std::runtime_error("ktx2 level does not match its format!");
+		}
+
+		data.levels.push_back(level);
+	}
+
+	return data;
+}
+
+struct SamplerKey
+{
+	vk::Filter             filter      = vk::Filter::eLinear;
+	vk::SamplerMipmapMode  mipmapMode  = vk::SamplerMipmapMode::eLinear;
+	vk::SamplerAddressMode addressMode = vk::SamplerAddressMode::eRepeat;
+	float                  anisotropy  = TEXTURE_MAX_ANISOTROPY;        // 1 turns it off
+
+	bool operator==(const SamplerKey &other) const
+	{
+		return filter == other.filter && mipmapMode == other.mipmapMode && addressMode == other.addressMode && anisotropy == other.anisotropy;
+	}
+};
+
+struct SamplerKeyHash
+{
+	size_t operator()(const SamplerKey &key) const
+	{
+		size_t hash = std::hash<uint32_t>()(static_cast<uint32_t>(key.filter) | static_cast<uint32_t>(key.mipmapMode) << 8 | static_cast<uint32_t>(key.addressMode) << 16);
+		return hash ^ (std::hash<float>()(key.anisotropy) << 1);
+	}
+};
+
+// Samplers are few and immutable, so every distinct state is created once
+// and shared by all textures using it.
+class SamplerCache
+{
+  public:
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device)
+	{
+		this->device = device;
+
+		// createLogicalDevice enables anisotropy whenever the device has it
+		if (physicalDevice.getFeatures().samplerAnisotropy)
+		{
+			maxAnisotropy = physicalDevice.getProperties().limits.maxSamplerAnisotropy;
+		}
+	}
+
+	void destroy()
+	{
+		for (auto &entry : samplers)
+		{
+			device.destroySampler(entry.second);
+		}
+		samplers.clear();
+	}
+
+	vk::Sampler get(const SamplerKey &key)
+	{
+		auto found = samplers.find(key);
+		if (found != samplers.end())
+		{
+			return found->second;
+		}
+
+		float anisotropy = std::min(key.anisotropy, maxAnisotropy);
+
+		auto samplerInfo             = vk::SamplerCreateInfo();
+		samplerInfo.magFilter        = key.filter;
+		samplerInfo.minFilter        = key.filter;
+		samplerInfo.mipmapMode       = key.mipmapMode;
+		samplerInfo.addressModeU     = key.addressMode;
+		samplerInfo.addressModeV     = key.addressMode;
+		samplerInfo.addressModeW     = key.addressMode;
+		samplerInfo.anisotropyEnable = anisotropy > 1.0f;
+		samplerInfo.maxAnisotropy    = std::max(anisotropy, 1.0f);
+		samplerInfo.minLod           = 0.0f;
+		samplerInfo.maxLod           = VK_LOD_CLAMP_NONE;
+
+		auto sampler = device.createSampler(samplerInfo);
+		samplers.emplace(key, sampler);
+		return sampler;
+	}
+
+  private:
+	vk::Device                                                     device;
+	float                                                          maxAnisotropy = 1.0f;
+	std::unordered_map<SamplerKey, vk::Sampler, SamplerKeyHash> samplers;
+};
+
+// Streams KTX2 textures from disk. Files are read by background jobs, then
+// their levels are copied in from a per-frame staging buffer smallest
+// first, so a texture shows up blurry after a frame and sharpens as the
+// larger levels arrive. Every time levels become resident the texture gets
+// a new view over them in a new bindless slot; the old slot may still be
+// used by frames in flight and is released once they finished. Textures
+// stay resident until the manager is destroyed.
+class TextureManager
+{
+  public:
+	SamplerCache samplers;
+
+	// every *.ktx2 file in directory becomes a texture, sorted by name
+	void create(vk::PhysicalDevice physicalDevice, vk::Device device, BindlessDescriptors &bindless, JobSystem &jobs, const std::string &directory, uint32_t framesInFlight)
+	{
+		this->physicalDevice = physicalDevice;
+		this->device         = device;
+		this->bindless       = &bindless;
+		this->jobs           = &jobs;
+
+		samplers.create(physicalDevice, device);
+
+		// createLogicalDevice enables compression whenever the device has it
+		auto features = physicalDevice.getFeatures();
+		bcSupported   = features.textureCompressionBC;
+		astcSupported = features.textureCompressionASTC_LDR;
+
+		std::error_code error;
+		if (std::filesystem::is_directory(directory, error))
+		{
+			for (const auto &entry : std::filesystem::directory_iterator(directory))
+			{
+				if (entry.path().extension() == TEXTURE_EXTENSION)
+				{
+					texturePaths.push_back(entry.path().string());
+				}
+			}
+			std::sort(texturePaths.begin(), texturePaths.end());
+		}
+		textures.resize(texturePaths.size());
+
+		staging.resize(framesInFlight);
+		for (auto &frameStaging : staging)
+		{
+			frameStaging.buffer = device.createBuffer(vk::BufferCreateInfo({}, TEXTURE_UPLOAD_BYTES, vk::BufferUsageFlagBits::eTransferSrc));
+			frameStaging.memory = allocate(device.getBufferMemoryRequirements(frameStaging.buffer), vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+			device.bindBufferMemory(frameStaging.buffer, frameStaging.memory, 0);
+			frameStaging.mapped = static_cast<char *>(device.mapMemory(frameStaging.memory, 0, TEXTURE_UPLOAD_BYTES));
+		}
+
+		createWhiteTexture();
+
+		if (!texturePaths.empty())
+		{
+			std::cout << "Streaming " << texturePaths.size() << " textures from " << directory << "\n";
+		}
+	}
+
+	// waits for loads still running, their jobs point at this object
+	void destroy()
+	{
+		while (pendingLoads > 0)
+		{
+			TextureData *data;
+			while (finishedLoads.tryPop(data))
+			{
+				delete (data);
+				pendingLoads--;
+			}
+			std::this_thread::yield();
+		}
+
+		for (auto &retired : retiredViews)
+		{
+			device.destroyImageView(retired.view);
+		}
+		for (auto &texture : textures)
+		{
+			destroyTexture(texture);
+		}
+		destroyTexture(white);
+
+		for (auto &frameStaging : staging)
+		{
+			device.unmapMemory(frameStaging.memory);
+			device.destroyBuffer(frameStaging.buffer);
+			GpuMemory::free(device, frameStaging.memory);
+		}
+
+		samplers.destroy();
+	}
+
+	uint32_t textureCount() const
+	{
+		return static_cast<uint32_t>(textures.size());
+	}
+
+	// textures with every level uploaded
+	uint32_t residentCount() const
+	{
+		return static_cast<uint32_t>(std::count_if(textures.begin(), textures.end(), [](const Texture &texture) { return texture.state == TextureState::Resident; }));
+	}
+
+	// bindless slot of a 1x1 white texture, for untextured objects
+	uint32_t whiteTexture() const
+	{
+		return white.slot;
+	}
+
+	// Call once per frame after the frame's fence has signaled. Takes
+	// finished loads and releases views no frame in flight can use anymore.
+	void beginFrame(uint32_t frame)
+	{
+		PROFILE_ZONE("textures beginFrame");
+
+		frameNumber++;
+		currentFrame = frame;
+
+		TextureData *data;
+		while (finishedLoads.tryPop(data))
+		{
+			pendingLoads--;
+			auto &texture = textures[data->texture];
+			if (!data->error.empty())
+			{
+				std::cout << "Failed to stream " << texturePaths[data->texture] << ": " << data->error << "\n";
+				texture.state = TextureState::Failed;
+				delete (data);
+				continue;
+			}
+
+			texture.data.reset(data);
+			try
+			{
+				createImage(texture);
+				texture.state = TextureState::Streaming;
+				uploadQueue.push_back(&texture);
+			}
+			catch (const std::exception &e)
+			{
+				std::cout << "Failed to stream " << texturePaths[data->texture] << ": " << e.what() << "\n";
+				texture.state = TextureState::Failed;
+				texture.data.reset();
+			}
+		}
+
+		while (!retiredViews.empty() && retiredViews.front().frame + staging.size() < frameNumber)
+		{
+			device.destroyImageView(retiredViews.front().view);
+			bindless->releaseSampledImage(retiredViews.front().slot);
+			retiredViews.pop_front();
+		}
+	}
+
+	// returns the bindless slot of the texture's resident levels, the white
+	// texture until the first level arrived; starts loading on first use
+	uint32_t request(uint32_t textureIndex)
+	{
+		if (textureIndex >= textures.size())
+		{
+			return white.slot;
+		}
+
+		auto &texture = textures[textureIndex];
+		if (texture.state == TextureState::Unloaded && pendingLoads < MAX_PENDING_TEXTURE_LOADS)
+		{
+			texture.state = TextureState::Loading;
+			pendingLoads++;
+
+			auto path = texturePaths[textureIndex];
+			jobs->runBackground(jobs->create("load texture", [this, textureIndex, path] {
+				auto data = new TextureData();
+				try
+				{
+					*data = readKtx2File(path);
+				}
+				catch (const std::exception &e)
+				{
+					data->error = e.what();
+				}
+				data->texture = textureIndex;
+				finishedLoads.push(data);
+			}));
+		}
+
+		return texture.view ? texture.slot : white.slot;
+	}
+
+	// Copies the next levels of streaming textures, smallest level first.
+	// Must be recorded before the draws of the frame. Levels that are
+	// complete are transitioned for sampling and published with a new view.
+	void recordUploads(vk::CommandBuffer commandBuffer)
+	{
+		if (uploadQueue.empty())
+		{
+			return;
+		}
+
+		PROFILE_ZONE("texture uploads");
+
+		auto          &frameStaging  = staging[currentFrame];
+		vk::DeviceSize stagingOffset = 0;
+
+		struct Copy
+		{
+			Texture            *texture;
+			vk::BufferImageCopy region;
+		};
+		std::vector<Copy>      copies;
+		std::vector<Texture *> touched;
+
+		for (auto queued = uploadQueue.begin(); queued != uploadQueue.end() && stagingOffset < TEXTURE_UPLOAD_BYTES; ++queued)
+		{
+			auto &texture = **queued;
+			auto &data    = *texture.data;
+
+			while (texture.uploadLevel < texture.dataLevels)
+			{
+				// the cursor counts levels down from the smallest one
+				uint32_t level     = texture.dataLevels - 1 - texture.uploadLevel;
+				auto    &source    = data.levels[level];
+				uint32_t blockRows = (source.height + data.block.height - 1) / data.block.height;
+				auto     rowBytes  = vk::DeviceSize((source.width + data.block.width - 1) / data.block.width) * data.block.bytes;
+
+				// offsets into the staging buffer must be a multiple of the block size
+				stagingOffset = (stagingOffset + 15) & ~vk::DeviceSize(15);
+				if (stagingOffset + rowBytes > TEXTURE_UPLOAD_BYTES)
+				{
+					break;
+				}
+
+				uint32_t rows = std::min(blockRows - texture.uploadRow, static_cast<uint32_t>((TEXTURE_UPLOAD_BYTES - stagingOffset) / rowBytes));
+				std::memcpy(frameStaging.mapped + stagingOffset, data.bytes.data() + source.offset + texture.uploadRow * rowBytes, rows * rowBytes);
+
+				auto region             = vk::BufferImageCopy();
+				region.bufferOffset     = stagingOffset;
+				region.imageSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+				region.imageOffset      = vk::Offset3D(0, static_cast<int32_t>(texture.uploadRow * data.block.height), 0);
+				region.imageExtent      = vk::Extent3D(source.width, std::min((texture.uploadRow + rows) * data.block.height, source.height) - texture.uploadRow * data.block.height, 1);
+				copies.push_back({&texture, region});
+
+				if (touched.empty() || touched.back() != &texture)
+				{
+					touched.push_back(&texture);
+				}
+
+				stagingOffset += rows * rowBytes;
+				bytesStreamed += rows * rowBytes;
+				texture.uploadRow += rows;
+				if (texture.uploadRow < blockRows)
+				{
+					break;
+				}
+
+				texture.uploadRow = 0;
+				texture.uploadLevel++;
+			}
+		}
+
+		if (copies.empty())
+		{
+			return;
+		}
+
+		// levels are written for the first time, their old contents do not matter
+		std::vector<vk::ImageMemoryBarrier2> toTransfer;
+		for (auto texture : touched)
+		{
+			if (!texture->transferLayout)
+			{
+				toTransfer.push_back(imageBarrier(texture->image, vk::PipelineStageFlagBits2::eNone, vk::AccessFlagBits2::eNone,
+				                                  vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+				                                  vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal, 0, texture->levelCount));
+				texture->transferLayout = true;
+			}
+		}
+		if (!toTransfer.empty())
+		{
+			recordBarriers(commandBuffer, toTransfer);
+		}
+
+		for (const auto &copy : copies)
+		{
+			commandBuffer.copyBufferToImage(frameStaging.buffer, copy.texture->image, vk::ImageLayout::eTransferDstOptimal, copy.region);
+		}
+
+		std::vector<vk::ImageMemoryBarrier2> toShader;
+		std::vector<Texture *>               completed;
+		for (auto texture : touched)
+		{
+			// the levels above the upload cursor are complete
+			uint32_t firstComplete = texture->dataLevels - texture->uploadLevel;
+			if (firstComplete >= texture->readyLevel)
+			{
+				continue;
+			}
+
+			// generated levels only exist once the stored one is complete
+			if (texture->data->generateMips)
+			{
+				if (texture->uploadLevel < texture->dataLevels)
+				{
+					continue;
+				}
+				generateMips(commandBuffer, *texture);
+				firstComplete = 0;
+			}
+			else
+			{
+				toShader.push_back(imageBarrier(texture->image, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+				                                vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead,
+				                                vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+				                                firstComplete, texture->readyLevel - firstComplete));
+			}
+
+			texture->readyLevel = firstComplete;
+			completed.push_back(texture);
+		}
+		if (!toShader.empty())
+		{
+			recordBarriers(commandBuffer, toShader);
+		}
+
+		for (auto texture : completed)
+		{
+			if (texture->readyLevel < texture->viewLevel)
+			{
+				publish(*texture, texture->readyLevel);
+			}
+		}
+
+		// fully uploaded textures leave the queue and free their file data
+		uploadQueue.erase(std::remove_if(uploadQueue.begin(), uploadQueue.end(), [](Texture *texture) {
+			                  if (texture->uploadLevel < texture->dataLevels)
+			                  {
+				                  return false;
+			                  }
+			                  texture->state = TextureState::Resident;
+			                  texture->data.reset();
+			                  return true;
+		                  }),
+		                  uploadQueue.end());
+	}
+
+	uint64_t streamedBytes() const
+	{
+		return bytesStreamed;
+	}
+
+  private:
+	enum class TextureState
+	{
+		Unloaded,
+		Loading,
+		Streaming,        // levels are being uploaded, some may be resident already
+		Resident,
+		Failed
+	};
+
+	struct Texture
+	{
+		TextureState                 state = TextureState::Unloaded;
+		std::unique_ptr<TextureData> data;
+		vk::Image                    image;
+		vk::DeviceMemory             memory;
+		vk::Format                   format;
+		vk::ImageView                view;                      // over levels [viewLevel, levelCount)
+		uint32_t                     slot           = 0;
+		uint32_t                     levelCount     = 0;        // of the image
+		uint32_t                     dataLevels     = 0;        // levels stored in the file
+		uint32_t                     readyLevel     = 0;        // largest level ready for sampling, levelCount while none is
+		uint32_t                     viewLevel      = 0;        // largest level in the view
+		uint32_t                     uploadLevel    = 0;        // upload cursor, counted from the smallest level
+		uint32_t                     uploadRow      = 0;        // block row within the level
+		bool                         transferLayout = false;
+	};
+
+	struct RetiredView
+	{
+		vk::ImageView view;
+		uint32_t      slot;
+		uint64_t      frame;
+	};
+
+	struct Staging
+	{
+		vk::Buffer       buffer;
+		vk::DeviceMemory memory;
+		char            *mapped;
+	};
+
+	vk::PhysicalDevice   physicalDevice;
+	vk::Device           device;
+	BindlessDescriptors *bindless;
+	JobSystem           *jobs;
+	bool                 bcSupported;
+	bool                 astcSupported;
+
+	std::vector<std::string>      texturePaths;
+	std::vector<Texture>          textures;
+	Texture                       white;
+	std::vector<Staging>          staging;
+	std::deque<Texture *>         uploadQueue;
+	std::deque<RetiredView>       retiredViews;
+	MpscQueue<TextureData *, 256> finishedLoads;
+	uint32_t                      pendingLoads  = 0;
+	uint64_t                      frameNumber   = 0;
+	uint32_t                      currentFrame  = 0;
+	uint64_t                      bytesStreamed = 0;
+
+	// throws when the device cannot sample the format
+	void checkFormatSupport(const TextureData &data) const
+	{
+		bool compressionSupported = isAstcFormat(data.format) ? astcSupported : !data.block.compressed || bcSupported;
+		auto features             = physicalDevice.getFormatProperties(data.format).optimalTilingFeatures;
+		if (!compressionSupported || !(features & vk::FormatFeatureFlagBits::eSampledImage))
+		{
+			throw std::runtime_error("texture format " + vk::to_string(data.format) + " is not supported by the device!");
+		}
+	}
+
+	// Blitting down the chain needs linear filtering and blits on the format,
+	// compressed formats never have them and must ship their mips.
+	bool canGenerateMips(vk::Format format) const
+	{
+		auto required = vk::FormatFeatureFlagBits::eBlitSrc | vk::FormatFeatureFlagBits::eBlitDst | vk::FormatFeatureFlagBits::eSampledImageFilterLinear;
+		return (physicalDevice.getFormatProperties(format).optimalTilingFeatures & required) == required;
+	}
+
+	void createImage(Texture &texture)
+	{
+		auto &data = *texture.data;
+		checkFormatSupport(data);
+
+		auto &base         = data.levels[0];
+		texture.format     = data.format;
+		texture.dataLevels = static_cast<uint32_t>(data.levels.size());
+		texture.levelCount = texture.dataLevels;
+
+		if (data.generateMips && canGenerateMips(data.format))
+		{
+			uint32_t size = std::max(base.width, base.height);
+			while (size >> texture.levelCount)
+			{
+				texture.levelCount++;
+			}
+		}
+
+		// nothing to generate for an unsupported format or a 1x1 base, it takes the plain upload barrier
+		if (texture.levelCount == texture.dataLevels)
+		{
+			data.generateMips = false;
+		}
+		texture.readyLevel = texture.levelCount;
+		texture.viewLevel  = texture.levelCount;
+
+		auto imageInfo          = vk::ImageCreateInfo();
+		imageInfo.imageType     = vk::ImageType::e2D;
+		imageInfo.format        = data.format;
+		imageInfo.extent        = vk::Extent3D(base.width, base.height, 1);
+		imageInfo.mipLevels     = texture.levelCount;
+		imageInfo.arrayLayers   = 1;
+		imageInfo.samples       = vk::SampleCountFlagBits::e1;
+		imageInfo.tiling        = vk::ImageTiling::eOptimal;
+		imageInfo.usage         = vk::ImageUsageFlagBits::eSampled | vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eTransferSrc;
+		imageInfo.sharingMode   = vk::SharingMode::eExclusive;
+		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+		texture.image  = device.createImage(imageInfo);
+		texture.memory = allocate(device.getImageMemoryRequirements(texture.image), vk::MemoryPropertyFlagBits::eDeviceLocal);
+		device.bindImageMemory(texture.image, texture.memory, 0);
+	}
+
+	// standard blit chain, leaves every level ready for sampling
+	void generateMips(vk::CommandBuffer commandBuffer, Texture &texture)
+	{
+		int32_t width  = static_cast<int32_t>(texture.data->levels[0].width);
+		int32_t height = static_cast<int32_t>(texture.data->levels[0].height);
+
+		for (uint32_t level = 1; level < texture.levelCount; level++)
+		{
+			auto toSource = imageBarrier(texture.image, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+			                             vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead,
+			                             vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eTransferSrcOptimal, level - 1, 1);
+			recordBarriers(commandBuffer, toSource);
+
+			int32_t nextWidth  = std::max(width / 2, 1);
+			int32_t nextHeight = std::max(height / 2, 1);
+
+			auto blit           = vk::ImageBlit();
+			blit.srcSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level - 1, 0, 1);
+			blit.srcOffsets[1]  = vk::Offset3D(width, height, 1);
+			blit.dstSubresource = vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+			blit.dstOffsets[1]  = vk::Offset3D(nextWidth, nextHeight, 1);
+			commandBuffer.blitImage(texture.image, vk::ImageLayout::eTransferSrcOptimal, texture.image, vk::ImageLayout::eTransferDstOptimal, blit, vk::Filter::eLinear);
+
+			width  = nextWidth;
+			height = nextHeight;
+		}
+
+		std::array<vk::ImageMemoryBarrier2, 2> toShader = {
+		    imageBarrier(texture.image, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferRead,
+		                 vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead,
+		                 vk::ImageLayout::eTransferSrcOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, 0, texture.levelCount - 1),
+		    imageBarrier(texture.image, vk::PipelineStageFlagBits2::eTransfer, vk::AccessFlagBits2::eTransferWrite,
+		                 vk::PipelineStageFlagBits2::eFragmentShader, vk::AccessFlagBits2::eShaderSampledRead,
+		                 vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal, texture.levelCount - 1, 1)};
+		recordBarriers(commandBuffer, toShader);
+	}
+
+	// points a new slot at levels [baseLevel, levelCount), the previous view retires with its slot
+	void publish(Texture &texture, uint32_t baseLevel)
+	{
+		texture.viewLevel = baseLevel;
+
+		auto viewInfo             = vk::ImageViewCreateInfo();
+		viewInfo.image            = texture.image;
+		viewInfo.viewType         = vk::ImageViewType::e2D;
+		viewInfo.format           = texture.format;
+		viewInfo.subresourceRange = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, baseLevel, texture.levelCount - baseLevel, 0, 1);
+		auto view                 = device.createImageView(viewInfo);
+
+		if (texture.view)
+		{
+			retiredViews.push_back({texture.view, texture.slot, frameNumber});
+		}
+
+		texture.view = view;
+		texture.slot = bindless->registerSampledImage(view, samplers.get(SamplerKey()));
+	}
+
+	// Uploaded through the regular path by the first frame, before its
+	// draws. The view is published right away so the slot never changes.
+	void createWhiteTexture()
+	{
+		white.data.reset(new TextureData());
+		white.data->format       = vk::Format::eR8G8B8A8Unorm;
+		white.data->bytes        = {'\xFF', '\xFF', '\xFF', '\xFF'};
+		white.data->levels       = {{0, 4, 1, 1}};
+		white.data->generateMips = false;
+		getFormatBlock(white.data->format, white.data->block);
+
+		createImage(white);
+		publish(white, 0);
+
+		white.state = TextureState::Streaming;
+		uploadQueue.push_back(&white);
+	}
+
+	void destroyTexture(Texture &texture)
+	{
+		if (texture.view)
+		{
+			device.destroyImageView(texture.view);
+		}
+		if (texture.image)
+		{
+			device.destroyImage(texture.image);
+			GpuMemory::free(device, texture.memory);
+		}
+	}
+
+	static vk::ImageMemoryBarrier2 imageBarrier(vk::Image image, vk::PipelineStageFlags2 srcStage, vk::AccessFlags2 srcAccess,
+	                                            vk::PipelineStageFlags2 dstStage, vk::AccessFlags2 dstAccess,
+	                                            vk::ImageLayout oldLayout, vk::ImageLayout newLayout, uint32_t baseLevel, uint32_t levelCount)
+	{
+		auto barrier                = vk::ImageMemoryBarrier2();
+		barrier.srcStageMask        = srcStage;
+		barrier.srcAccessMask       = srcAccess;
+		barrier.dstStageMask        = dstStage;
+		barrier.dstAccessMask       = dstAccess;
+		barrier.oldLayout           = oldLayout;
+		barrier.newLayout           = newLayout;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image               = image;
+		barrier.subresourceRange    = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, baseLevel, levelCount, 0, 1);
+		return barrier;
+	}
+
+	static void recordBarriers(vk::CommandBuffer commandBuffer, vk::ArrayProxy<const vk::ImageMemoryBarrier2> barriers)
+	{
+		auto dependencyInfo                    = vk::DependencyInfo();
+		dependencyInfo.imageMemoryBarrierCount = barriers.size();
+		dependencyInfo.pImageMemoryBarriers    = barriers.data();
+		commandBuffer.pipelineBarrier2(dependencyInfo);
+	}
+
+	vk::DeviceMemory allocate(const vk::MemoryRequirements &requirements, vk::MemoryPropertyFlags properties)
+	{
+		auto memoryIndex = DeviceHelpers::findMemoryType(physicalDevice, requirements.memoryTypeBits, properties);
+		return GpuMemory::allocate(device, vk::MemoryAllocateInfo(requirements.size, memoryIndex));
+	}
+};
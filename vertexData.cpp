@@ -1,3 +1,5 @@
+#pragma once
+
 #include <glm/glm.hpp>
 #include <vector>
 
@@ -7,6 +9,7 @@ struct Vertex
 {
 	glm::vec2 pos;
 	glm::vec3 color;
+	glm::vec2 texCoord;
 
 	static vk::VertexInputBindingDescription getBindingDescription()
 	{
@@ -15,9 +18,9 @@ struct Vertex
 		return bindingDescription;
 	}
 
-	static std::array<vk::VertexInputAttributeDescription, 2> getAttributeDescriptions()
+	static std::array<vk::VertexInputAttributeDescription, 3> getAttributeDescriptions()
 	{
-		std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions{};
+		std::array<vk::VertexInputAttributeDescription, 3> attributeDescriptions{};
 
 		attributeDescriptions[0].binding  = 0;
 		attributeDescriptions[0].location = 0;
@@ -29,11 +32,60 @@ struct Vertex
 		attributeDescriptions[1].format   = vk::Format::eR32G32B32Sfloat;
 		attributeDescriptions[1].offset   = offsetof(Vertex, color);
 
+		attributeDescriptions[2].binding  = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format   = vk::Format::eR32G32Sfloat;
+		attributeDescriptions[2].offset   = offsetof(Vertex, texCoord);
+
 		return attributeDescriptions;
 	}
 };
 
 const std::vector<Vertex> vertices = {
-    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
-    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}}};
\ No newline at end of file
+    {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.5f, 0.0f}},
+    {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 1.0f}},
+    {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f}}};
+
+const std::vector<uint32_t> vertexIndices = {0, 1, 2};
+
+// a mesh in the shared vertex/index buffers, its levels of detail are in the mesh buffer
+struct Mesh
+{
+	uint32_t  lods;                  // index in the mesh buffer
+	glm::vec4 boundingSphere;        // object space center and radius
+};
+
+// per-object data, read by shaders from the bindless object buffer
+struct ObjectData
+{
+	glm::mat4 model;
+	glm::vec4 boundingSphere;
+	glm::vec4 tint;
+	uint32_t  mesh;           // index in the mesh buffer, the culling pass picks the level of detail from it
+	uint32_t  texture;        // bindless sampled image slot
+	uint32_t  padding[2];
+};
+
+// one entry of a draw list submitted by game code
+struct DrawItem
+{
+	glm::mat4 model;
+	glm::vec4 tint;
+};
+
+// must match the push_constant block in the shaders
+struct PushConstants
+{
+	glm::mat4 transform;
+	uint32_t  objectBuffer;        // bindless slot of the object buffer, objects are picked by instance index
+	uint32_t  padding[3];
+};
+
+// must match the uniform block in shader.vert, updated once per frame
+struct FrameUniforms
+{
+	glm::mat4 view;
+	glm::mat4 proj;
+};
+
+const uint32_t MAX_OBJECTS = 1024;
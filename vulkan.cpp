@@ -1,15 +1,38 @@
+#pragma once
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <deque>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <vector>
 
+#include <glm/gtc/matrix_transform.hpp>
 #include <vulkan/vulkan.hpp>
 
+#include "async_compute.cpp"
+#include "culling.cpp"
+#include "descriptors.cpp"
 #include "device_helpers.cpp"
+#include "device_selection.cpp"
 #include "file_helpers.cpp"
+#include "gpu_memory.cpp"
+#include "gpu_profiler.cpp"
+#include "jobs.cpp"
+#include "pipelines.cpp"
+#include "render_graph.cpp"
+#include "shader_reload.cpp"
+#include "sprites.cpp"
+#include "stats.cpp"
+#include "streaming.cpp"
+#include "submission_pool.cpp"
+#include "textures.cpp"
 #include "vertexData.cpp"
 
 const std::vector<const char *> validationLayers = {
@@ -17,20 +40,47 @@ const std::vector<const char *> validationLayers = {
 
 const int MAX_FRAMES_IN_FLIGHT = 2;
 
+// objects tested per job when culling on the cpu
+const size_t CPU_CULL_BATCH_SIZE = 128;
+
+// sprites written into the batch per job
+const size_t SPRITE_BATCH_SIZE = 4096;
+
+// every glsl source in here is compiled by the build and watched for hot reload
+const std::string SHADER_DIRECTORY = "shaders";
+
+// the sources the pipelines are built from
+const std::string VERTEX_SHADER          = "shader.vert";
+const std::string FRAGMENT_SHADER        = "shader.frag";
+const std::string CULL_SHADER            = "cull.comp";
+const std::string SPRITE_VERTEX_SHADER   = "sprite.vert";
+const std::string SPRITE_FRAGMENT_SHADER = "sprite.frag";
+
+static std::string shaderBinary(const std::string &shader)
+{
+	return shaderBinaryPath(SHADER_DIRECTORY + "/" + shader);
+}
+
 class Vulkan
 {
   public:
 	vk::Device device;
 
-	// dynamic
-	bool framebufferResized = false;
-
-	Vulkan(GLFWwindow *window)
+	// width and height are the framebuffer size of the window,
+	// requestedSamples is capped by what the device supports for color attachments,
+	// cpu side work is split into jobs on the shared scheduler,
+	// uncapped presents without waiting for vertical blank when the surface allows it
+	Vulkan(GLFWwindow *window, JobSystem &jobs, uint32_t width, uint32_t height,
+	       vk::SampleCountFlagBits requestedSamples = vk::SampleCountFlagBits::e4, bool uncapped = false)
 	{
-		this->window = window;
+		this->window      = window;
+		this->jobs        = &jobs;
+		this->uncapped    = uncapped;
+		framebufferWidth  = width;
+		framebufferHeight = height;
 		createInstance();
 		createSurface();
-		physicalDevice = DeviceHelpers::pickPhysicalDevice(instance, surface);
+		physicalDevice = DeviceSelector::pickPhysicalDevice(instance, surface);
 		indices        = DeviceHelpers::findQueueFamilies(physicalDevice, surface);
 
 		auto result = DeviceHelpers::createLogicalDevice(physicalDevice,
@@ -39,39 +89,126 @@ class Vulkan
 		device        = result.device;
 		graphicsQueue = result.graphicsQueue;
 		presentQueue  = result.presentQueue;
+		computeQueue  = result.computeQueue;
+		transferQueue = result.transferQueue;
+
+		asyncCompute.create(device, computeQueue, indices.computeFamily.value(), indices.graphicsFamily.value());
+
+		bindless.create(device, physicalDevice);
+
+		auto &capabilities = DeviceSelector::capabilities(physicalDevice);
+		dynamicRendering   = capabilities.dynamicRendering;
+		msaaSamples        = std::min(requestedSamples, capabilities.maxSampleCount);
 
 		createSwapChain();
 		createImageViews();
-		createRenderPass();
+		if (!dynamicRendering)
+		{
+			createColorResources();
+			createRenderPass();
+		}
+		createFrameDescriptorSetLayout();
 		createGraphicsPipeline();
-		createFramebuffers();
-		createCommandPool();
+		createCullingPipeline();
+		if (!dynamicRendering)
+		{
+			createFramebuffers();
+		}
 		createVertexBuffer();
-		createCommandBuffers();
-		createSyncObjects();
+		createMeshBuffer();
+		createIndexBuffer();
+		createObjectBuffers();
+		createDrawBuffers();
+		createUniformBuffers();
+		createFrameDescriptorSets();
+		submissions.create(device, graphicsQueue, indices.graphicsFamily.value());
+		createRenderFinishedSemaphores();
+
+		gpuProfiler.create(physicalDevice, device, indices.graphicsFamily.value(), submissions, MAX_FRAMES_IN_FLIGHT);
+		streaming.create(physicalDevice, device, jobs, STREAMING_DIRECTORY, MAX_FRAMES_IN_FLIGHT);
+		textures.create(physicalDevice, device, bindless, jobs, TEXTURE_DIRECTORY, MAX_FRAMES_IN_FLIGHT);
+
+		auto spriteTargets = PipelineManager::Targets{swapChainImageFormat, msaaSamples, renderPass};
+		sprites.create(physicalDevice, device, bindless, jobs, spriteTargets, shaderBinary(SPRITE_VERTEX_SHADER), shaderBinary(SPRITE_FRAGMENT_SHADER),
+		               textures.whiteTexture(), MAX_FRAMES_IN_FLIGHT);
+		statsOverlay.create(physicalDevice, device, bindless, jobs, spriteTargets, shaderBinary(SPRITE_VERTEX_SHADER), shaderBinary(SPRITE_FRAGMENT_SHADER),
+		                    textures.whiteTexture(), MAX_FRAMES_IN_FLIGHT, STREAMING_UPLOAD_BYTES + TEXTURE_UPLOAD_BYTES);
+		stats.memoryBudget = DeviceHelpers::isExtensionSupported(physicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+		renderGraph.create(physicalDevice, device);
+		buildRenderGraph();
+
+#ifdef THE_GAME_GLSLC
+		shaderWatcher = std::make_unique<ShaderWatcher>(THE_GAME_GLSLC, findShaderSources(SHADER_DIRECTORY));
+#endif
 
 		std::cout << "Vulkan initialisation done\n";
 	}
 	~Vulkan()
 	{
+		shaderWatcher.reset();
+
 		cleanupSwapChain();
 
 		device.destroyBuffer(vertexBuffer);
-		vkFreeMemory(device, vertexBufferMemory, nullptr);
+		GpuMemory::free(device, vertexBufferMemory);
 
-		vkDestroyPipeline(device, graphicsPipeline, nullptr);
-		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		device.destroyBuffer(indexBuffer);
+		GpuMemory::free(device, indexBufferMemory);
 
-		vkDestroyRenderPass(device, renderPass, nullptr);
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			device.unmapMemory(objectBuffersMemory[i]);
+			device.destroyBuffer(objectBuffers[i]);
+			GpuMemory::free(device, objectBuffersMemory[i]);
+		}
+
+		device.unmapMemory(meshBufferMemory);
+		device.destroyBuffer(meshBuffer);
+		GpuMemory::free(device, meshBufferMemory);
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			device.unmapMemory(uniformBuffersMemory[i]);
+			device.destroyBuffer(uniformBuffers[i]);
+			GpuMemory::free(device, uniformBuffersMemory[i]);
+		}
 
 		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
 		{
-			vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-			vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-			vkDestroyFence(device, inFlightFences[i], nullptr);
+			device.destroyBuffer(drawBuffers[i]);
+			GpuMemory::free(device, drawBuffersMemory[i]);
+			device.destroyBuffer(drawCountBuffers[i]);
+			GpuMemory::free(device, drawCountBuffersMemory[i]);
+		}
+
+		device.destroyPipeline(cullingPipeline);
+		device.destroyPipelineLayout(cullingPipelineLayout);
+
+		for (auto &retired : retiredPipelines)
+		{
+			device.destroyPipeline(retired.pipeline);
 		}
 
-		vkDestroyCommandPool(device, commandPool, nullptr);
+		device.destroyDescriptorPool(frameDescriptorPool);
+		device.destroyDescriptorSetLayout(frameDescriptorSetLayout);
+
+		pipelines.destroy();
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+
+		bindless.destroy();
+
+		vkDestroyRenderPass(device, renderPass, nullptr);
+
+		// also destroys the frame's command buffers and semaphores
+		submissions.destroy();
+
+		asyncCompute.destroy();
+		gpuProfiler.destroy();
+		streaming.destroy();
+		sprites.destroy();
+		statsOverlay.destroy();
+		textures.destroy();
 
 		vkDestroyDevice(device, nullptr);
 
@@ -81,6 +218,8 @@ class Vulkan
 
 	void updateVertexBuffer(std::vector<Vertex> v)
 	{
+		PROFILE_ZONE("updateVertexBuffer");
+
 		auto  size = sizeof(v[0]) * v.size();
 		void *data;
 		data = device.mapMemory(vertexBufferMemory, 0, size);
@@ -88,51 +227,167 @@ class Vulkan
 		device.unmapMemory(vertexBufferMemory);
 	}
 
-	void drawFrame()
+	// transform applied on top of every object's model matrix, sent as a push constant every frame
+	void setTransform(const glm::mat4 &transform)
+	{
+		objectTransform = transform;
+	}
+
+	// adds an instance of the built-in mesh, returns its index in the object buffer
+	uint32_t addObject(const glm::mat4 &model, const glm::vec4 &tint)
 	{
-		// todo check result
-		auto r = device.waitForFences(1, &inFlightFences[currentFrame], true, UINT64_MAX);
+		if (objectCount >= MAX_OBJECTS)
+		{
+			throw std::runtime_error("too many objects!");
+		}
+
+		objectsVersion++;
+		auto &object          = objects[objectCount];
+		object.model          = model;
+		object.boundingSphere = triangleMesh.boundingSphere;
+		object.tint           = tint;
+		object.mesh           = triangleMesh.lods;
+		object.texture        = textures.whiteTexture();
+
+		return objectCount++;
+	}
+
+	// the window may only be queried on the main thread, so it reports size changes here
+	void setFramebufferSize(uint32_t width, uint32_t height)
+	{
+		framebufferWidth   = width;
+		framebufferHeight  = height;
+		framebufferResized = true;
+	}
+
+	// replaces all objects with the items of the list
+	void setDrawList(const std::vector<DrawItem> &items)
+	{
+		objectCount = 0;
+		objectsVersion++;
+		for (const auto &item : items)
+		{
+			addObject(item.model, item.tint);
+		}
+	}
+
+	// chunks that are not resident yet are loaded in the background and drawn once they are
+	void setStreamedChunks(const std::vector<ChunkInstance> &instances)
+	{
+		streamedChunks = instances;
+	}
+
+	void setSprites(const std::vector<Sprite> &sprites)
+	{
+		spriteList = sprites;
+	}
+
+	void setStatsOverlay(bool visible)
+	{
+		statsVisible = visible;
+	}
+
+	// writes the current statistics as json, a failed write is reported and the game goes on
+	void dumpStats(const std::string &path)
+	{
+		refreshStats();
+		try
+		{
+			stats.writeJson(path);
+			std::cout << "Stats written to " << path << "\n";
+		}
+		catch (const std::exception &e)
+		{
+			std::cout << "Failed to write " << path << ": " << e.what() << "\n";
+		}
+	}
+
+	void waitIdle()
+	{
+		device.waitIdle();
+	}
+
+	// returns false when nothing was presented because the window is minimized
+	bool drawFrame()
+	{
+		if (framebufferWidth == 0 || framebufferHeight == 0)
+		{
+			return false;
+		}
+
+		PROFILE_ZONE("drawFrame");
+
+		{
+			PROFILE_ZONE("wait for frame fence");
+			submissions.wait(frameSubmissions[currentFrame]);
+		}
+		submissions.collect();
+		asyncCompute.collect();
+
+		frameNumber++;
+		reloadShaders();
+		pipelines.beginFrame();
 
 		uint32_t   imageIndex;
-		vk::Result result =
-		    device.acquireNextImageKHR(swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+		vk::Result result;
+		auto       imageAvailable = submissions.acquireSemaphore();
+		{
+			PROFILE_ZONE("acquire image");
+			result = device.acquireNextImageKHR(swapChain, UINT64_MAX, imageAvailable, VK_NULL_HANDLE, &imageIndex);
+		}
 
 		if (result == vk::Result::eErrorOutOfDateKHR)
 		{
+			// nothing was signaled, the semaphore can be reused right away
+			submissions.releaseSemaphore(imageAvailable);
 			recreateSwapChain();
-			return;
+			return true;
 		}
 		else if (result != vk::Result::eSuccess && result != vk::Result::eSuboptimalKHR)
 		{
 			throw std::runtime_error("failed to acquire swap chain image!");
 		}
 
-		// todo check result
-		r = device.resetFences(1, &inFlightFences[currentFrame]);
+		streaming.beginFrame(currentFrame);
+		textures.beginFrame(currentFrame);
+		batchSprites();
+		updateStats();
 
-		commandBuffers[currentFrame].reset();
-		recordCommandBuffer(commandBuffers[currentFrame], imageIndex);
+		updateUniformBuffer(currentFrame);
+		updateObjectBuffer(currentFrame);
+		requestStreamedChunks(cullingFrustum());
 
-		auto submitInfo = vk::SubmitInfo();
+		// culling runs on the compute queue while the graphics queue finishes the previous frame
+		bool cullAsync = gpuCulling && asyncCompute.isAsync();
 
-		vk::Semaphore          waitSemaphores[] = {imageAvailableSemaphores[currentFrame]};
-		vk::PipelineStageFlags waitStages[]     = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
-		submitInfo.waitSemaphoreCount           = 1;
-		submitInfo.pWaitSemaphores              = waitSemaphores;
-		submitInfo.pWaitDstStageMask            = waitStages;
+		std::vector<vk::Semaphore>          waitSemaphores = {imageAvailable};
+		std::vector<vk::PipelineStageFlags> waitStages     = {vk::PipelineStageFlagBits::eColorAttachmentOutput};
+		if (cullAsync)
+		{
+			auto cullingFinished      = submissions.acquireSemaphore();
+			auto computeCommandBuffer = asyncCompute.begin();
+			recordCulling(computeCommandBuffer);
+			asyncCompute.submit(computeCommandBuffer, cullingFinished);
 
-		submitInfo.commandBufferCount = 1;
-		submitInfo.pCommandBuffers    = &commandBuffers[currentFrame];
+			waitSemaphores.push_back(cullingFinished);
+			waitStages.push_back(vk::PipelineStageFlagBits::eDrawIndirect);
+		}
 
-		vk::Semaphore signalSemaphores[] = {renderFinishedSemaphores[currentFrame]};
-		submitInfo.signalSemaphoreCount  = 1;
-		submitInfo.pSignalSemaphores     = signalSemaphores;
+		auto commandBuffer = submissions.beginCommands();
+		recordCommandBuffer(commandBuffer, imageIndex);
 
-		graphicsQueue.submit(submitInfo, inFlightFences[currentFrame]);
+		auto renderFinished            = renderFinishedSemaphores[imageIndex];
+		frameSubmissions[currentFrame] = submissions.submit(commandBuffer, waitSemaphores, waitStages, {renderFinished});
+
+		// unsignaled again once the frame's submission has completed
+		for (auto semaphore : waitSemaphores)
+		{
+			submissions.releaseSemaphore(semaphore, frameSubmissions[currentFrame]);
+		}
 
 		auto presentInfo               = vk::PresentInfoKHR();
 		presentInfo.waitSemaphoreCount = 1;
-		presentInfo.pWaitSemaphores    = signalSemaphores;
+		presentInfo.pWaitSemaphores    = &renderFinished;
 
 		vk::SwapchainKHR swapChains[] = {swapChain};
 		presentInfo.swapchainCount    = 1;
@@ -153,6 +408,8 @@ class Vulkan
 		}
 
 		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+
+		return true;
 	}
 
   private:
@@ -161,30 +418,136 @@ class Vulkan
 	vk::PhysicalDevice             physicalDevice;
 	vk::Queue                      graphicsQueue;        // queue to the selected logical device
 	vk::Queue                      presentQueue;         // presentation qeueue, connected to the surface
+	vk::Queue                      computeQueue;         // async compute, same as graphicsQueue without a dedicated family
+	vk::Queue                      transferQueue;        // dedicated transfer queue for uploads, if there is one
 	vk::SwapchainKHR               swapChain;
 	std::vector<vk::Image>         swapChainImages;
 	vk::Format                     swapChainImageFormat;
 	vk::Extent2D                   swapChainExtent;
 	std::vector<vk::ImageView>     swapChainImageViews;
-	vk::RenderPass                 renderPass;
+	vk::RenderPass                 renderPass;        // only used when dynamic rendering is not available
 	vk::PipelineLayout             pipelineLayout;
-	vk::Pipeline                   graphicsPipeline;
-	vk::CommandPool                commandPool;
+	PipelineManager                pipelines;
+	PipelineKey                    scenePipeline;        // prepared up front, never missing
 	std::vector<vk::Framebuffer>   swapChainFramebuffers;
-	std::vector<vk::CommandBuffer> commandBuffers;
 	vk::Buffer                     vertexBuffer;
 	vk::DeviceMemory               vertexBufferMemory;
-
-	// rendering related
-	std::vector<VkSemaphore> imageAvailableSemaphores;
-	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<vk::Fence>   inFlightFences;
+	vk::Buffer                     indexBuffer;
+	vk::DeviceMemory               indexBufferMemory;
+	Mesh                           triangleMesh;
+
+	// global descriptor set, all shader resources are referenced by slot index
+	BindlessDescriptors bindless;
+
+	// levels of detail of every mesh, persistently mapped; the cpu copy serves the cpu culling path
+	vk::Buffer            meshBuffer;
+	vk::DeviceMemory      meshBufferMemory;
+	MeshLods             *meshData;
+	uint32_t              meshBufferIndex;
+	std::vector<MeshLods> meshLods;
+
+	// Per-object data. Packets edit the cpu copy while frames are in flight,
+	// it is copied into the frame's persistently mapped buffer once that
+	// frame's fence has signaled and only when it changed since.
+	std::vector<ObjectData>       objects         = std::vector<ObjectData>(MAX_OBJECTS);
+	uint64_t                      objectsVersion  = 1;
+	uint32_t                      objectCount     = 0;
+	glm::mat4                     objectTransform = glm::mat4(1.0f);
+	std::vector<vk::Buffer>       objectBuffers;
+	std::vector<vk::DeviceMemory> objectBuffersMemory;
+	std::vector<ObjectData *>     objectData;
+	std::vector<uint32_t>         objectBufferIndices;
+	std::vector<uint64_t>         objectBufferVersions;        // of the cpu copy in each frame's buffer
+
+	JobSystem           *jobs;
+	bool                 uncapped;
+	std::vector<uint8_t> cpuVisible = std::vector<uint8_t>(MAX_OBJECTS);        // cpu culling results per object, 0 when culled, otherwise the lod level plus one
+
+	// geometry streamed from STREAMING_DIRECTORY
+	ResidencyManager           streaming;
+	std::vector<ChunkInstance> streamedChunks;
+	std::vector<uint32_t>      visibleChunks;        // instances that passed the frustum test this frame
+
+	// textures streamed from TEXTURE_DIRECTORY, shaders sample them by bindless slot
+	TextureManager textures;
+
+	// screen space sprites drawn over the scene, written into the batch every frame
+	SpriteBatch           sprites;
+	std::vector<Sprite>   spriteList;
+	std::vector<uint32_t> spriteTextureSlots;
+
+	// frame times, uploads and memory, drawn by the overlay while it is visible
+	RendererStats                         stats;
+	StatsOverlay                          statsOverlay;
+	bool                                  statsVisible = false;
+	std::chrono::steady_clock::time_point lastFrameStart;
+	uint64_t                              uploadedBytes = 0;        // by streaming and textures before this frame
+
+	GpuProfiler gpuProfiler;
+
+	// shader hot reload, replaced pipelines wait here until no frame in flight uses them
+	struct RetiredPipeline
+	{
+		vk::Pipeline pipeline;
+		uint64_t     frame;
+	};
+
+	std::unique_ptr<ShaderWatcher> shaderWatcher;
+	std::deque<RetiredPipeline>    retiredPipelines;
+	uint64_t                       frameNumber = 0;
+
+	// gpu culling, the compute pass writes the surviving draws for the frame
+	bool                          gpuCulling;
+	AsyncCompute                  asyncCompute;
+	vk::PipelineLayout            cullingPipelineLayout;
+	vk::Pipeline                  cullingPipeline;
+	std::vector<vk::Buffer>       drawBuffers;
+	std::vector<vk::DeviceMemory> drawBuffersMemory;
+	std::vector<uint32_t>         drawBufferIndices;
+	std::vector<vk::Buffer>       drawCountBuffers;
+	std::vector<vk::DeviceMemory> drawCountBuffersMemory;
+	std::vector<uint32_t>         drawCountBufferIndices;
+
+	// per-frame uniforms, one buffer per frame in flight
+	std::vector<vk::Buffer>        uniformBuffers;
+	std::vector<vk::DeviceMemory>  uniformBuffersMemory;
+	std::vector<FrameUniforms *>   uniformBuffersMapped;
+	vk::DescriptorSetLayout        frameDescriptorSetLayout;
+	vk::DescriptorPool             frameDescriptorPool;
+	std::vector<vk::DescriptorSet> frameDescriptorSets;
+	FrameUniforms                  frameUniforms;
+
+	// rendering related, the frame's command buffers and semaphores come from the pool
+	SubmissionPool                submissions;
+	std::vector<SubmissionTicket> frameSubmissions = std::vector<SubmissionTicket>(MAX_FRAMES_IN_FLIGHT);
+	std::vector<vk::Semaphore>    renderFinishedSemaphores;        // one per swap chain image
 
 	QueueFamilyIndices indices;
 
 	// GLFW window
 	GLFWwindow *window;
 
+	// written by setFramebufferSize, a zero size means the window is minimized
+	std::atomic<uint32_t> framebufferWidth;
+	std::atomic<uint32_t> framebufferHeight;
+	std::atomic<bool>     framebufferResized = false;
+
+	// records straight against the swapchain image views, no render pass or framebuffers
+	bool dynamicRendering;
+
+	// passes of a frame, rebuilt with the swapchain since its transient images have the swapchain size
+	RenderGraph    renderGraph;
+	RenderResource swapChainTarget;
+	RenderResource multisampledTarget;
+	uint32_t       currentImage;
+
+	// multisampled color target, resolved into the swapchain image at the end of the pass;
+	// with dynamic rendering it is a transient image of the render graph instead
+	vk::SampleCountFlagBits msaaSamples;
+	vk::Image               colorImage;
+	vk::DeviceMemory        colorImageMemory;
+	vk::ImageView           colorImageView;
+
 	// dynamic variables
 	uint32_t currentFrame = 0;
 
@@ -196,7 +559,8 @@ class Vulkan
 			throw std::runtime_error("validation layers requested, but not available!");
 		}
 
-		vk::ApplicationInfo appInfo("The game");
+		// descriptor indexing is core since 1.2, dynamic rendering since 1.3
+		vk::ApplicationInfo appInfo("The game", 1, "No engine", 1, VK_API_VERSION_1_3);
 
 		auto requiredExtensions = getExtentions();
 
@@ -276,11 +640,11 @@ class Vulkan
 
 	void createSwapChain()
 	{
-		SwapChainSupportDetails swapChainSupport = DeviceHelpers::querySwapChainSupport(physicalDevice, surface);
+		SwapChainSupportDetails swapChainSupport = DeviceSelector::swapChainSupport(physicalDevice, surface);
 
 		vk::SurfaceFormatKHR surfaceFormat = DeviceHelpers::chooseSwapSurfaceFormat(swapChainSupport.formats);
-		auto                 presentMode   = DeviceHelpers::chooseSwapPresentMode(swapChainSupport.presentModes);
-		VkExtent2D           extent        = DeviceHelpers::chooseSwapExtent(swapChainSupport.capabilities, window);
+		auto                 presentMode   = DeviceHelpers::chooseSwapPresentMode(swapChainSupport.presentModes, uncapped);
+		VkExtent2D           extent        = DeviceHelpers::chooseSwapExtent(swapChainSupport.capabilities, framebufferWidth, framebufferHeight);
 
 		uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
 		if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount)
@@ -314,7 +678,7 @@ class Vulkan
 		    extent,
 		    1,        // image array layers
 		    vk::ImageUsageFlagBits::eColorAttachment,
-		    vk::SharingMode::eExclusive,        // todo!
+		    indices.graphicsFamily != indices.presentFamily ? vk::SharingMode::eConcurrent : vk::SharingMode::eExclusive,
 		    queueFamilyIndices,
 		    vk::SurfaceTransformFlagBitsKHR::eIdentity,
 		    vk::CompositeAlphaFlagBitsKHR::eOpaque,
@@ -356,107 +720,55 @@ class Vulkan
 		}
 	}
 
-	// https://vulkan-tutorial.com/images/vulkan_simplified_pipeline.svg
 	void createGraphicsPipeline()
 	{
-		auto vertShaderCode = readFile("shaders/vert.spv");
-		auto fragShaderCode = readFile("shaders/frag.spv");
-
-		vk::ShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-		vk::ShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-		auto vertShaderStageInfo = vk::PipelineShaderStageCreateInfo(
-		    {}, vk::ShaderStageFlagBits::eVertex, vertShaderModule, "main");
-
-		auto fragShaderStageInfo = vk::PipelineShaderStageCreateInfo(
-		    {}, vk::ShaderStageFlagBits::eFragment, fragShaderModule, "main");
-
-		vk::PipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
-
-		auto bindingDescription    = Vertex::getBindingDescription();
-		auto attributeDescriptions = Vertex::getAttributeDescriptions();
-
-		auto vertexInputInfo                            = vk::PipelineVertexInputStateCreateInfo();
-		vertexInputInfo.vertexBindingDescriptionCount   = 1;
-		vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-		vertexInputInfo.pVertexBindingDescriptions      = &bindingDescription;
-		vertexInputInfo.pVertexAttributeDescriptions    = attributeDescriptions.data();
-
-		auto inputAssembly = vk::PipelineInputAssemblyStateCreateInfo({}, vk::PrimitiveTopology::eTriangleList, false);
-
-		std::vector<vk::DynamicState> dynamicStates = {
-		    vk::DynamicState::eViewport,
-		    vk::DynamicState::eScissor};
-
-		auto dynamicState = vk::PipelineDynamicStateCreateInfo({}, static_cast<uint32_t>(dynamicStates.size()), dynamicStates.data());
+		auto pushConstantRange = vk::PushConstantRange(
+		    vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+		    0,
+		    sizeof(PushConstants));
 
-		auto viewportState = vk::PipelineViewportStateCreateInfo({}, 1, {}, 1);
+		// set 0 is the global bindless set, set 1 holds the per-frame uniforms
+		vk::DescriptorSetLayout setLayouts[] = {bindless.layout, frameDescriptorSetLayout};
 
-		auto rasterizer        = vk::PipelineRasterizationStateCreateInfo();
-		rasterizer.polygonMode = vk::PolygonMode::eFill;
-		rasterizer.lineWidth   = 1.0f;
-		rasterizer.cullMode    = vk::CullModeFlagBits::eBack;
-		rasterizer.frontFace   = vk::FrontFace::eClockwise;
-
-		auto multisampling = vk::PipelineMultisampleStateCreateInfo();
-
-		auto colorBlendAttachment           = vk::PipelineColorBlendAttachmentState();
-		colorBlendAttachment.colorWriteMask = vk::ColorComponentFlagBits::eR |
-		                                      vk::ColorComponentFlagBits::eG |
-		                                      vk::ColorComponentFlagBits::eB |
-		                                      vk::ColorComponentFlagBits::eA;
-
-		auto colorBlending            = vk::PipelineColorBlendStateCreateInfo();
-		colorBlending.logicOp         = vk::LogicOp::eCopy;
-		colorBlending.attachmentCount = 1;
-		colorBlending.pAttachments    = &colorBlendAttachment;
-
-		auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo();
+		auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo({}, 2, setLayouts, 1, &pushConstantRange);
 		pipelineLayout          = device.createPipelineLayout(pipelineLayoutInfo);
 
-		auto pipelineInfo                = vk::GraphicsPipelineCreateInfo();
-		pipelineInfo.stageCount          = 2;
-		pipelineInfo.pStages             = shaderStages;
-		pipelineInfo.pVertexInputState   = &vertexInputInfo;
-		pipelineInfo.pInputAssemblyState = &inputAssembly;
-		pipelineInfo.pViewportState      = &viewportState;
-		pipelineInfo.pRasterizationState = &rasterizer;
-		pipelineInfo.pMultisampleState   = &multisampling;
-		pipelineInfo.pColorBlendState    = &colorBlending;
-		pipelineInfo.pDynamicState       = &dynamicState;
-		pipelineInfo.layout              = pipelineLayout;
-		pipelineInfo.renderPass          = renderPass;
-		pipelineInfo.subpass             = 0;
-		pipelineInfo.basePipelineHandle  = VK_NULL_HANDLE;
-
-		auto graphicsPipelineResult = device.createGraphicsPipeline(nullptr, pipelineInfo);
-		graphicsPipeline            = graphicsPipelineResult.value;
-
-		vkDestroyShaderModule(device, fragShaderModule, nullptr);
-		vkDestroyShaderModule(device, vertShaderModule, nullptr);
-	}
-
-	vk::ShaderModule createShaderModule(const std::vector<char> &code)
-	{
-		auto convertedCode    = reinterpret_cast<const uint32_t *>(code.data());
-		auto createModuleInfo = vk::ShaderModuleCreateInfo({}, code.size(), convertedCode);
-		return device.createShaderModule(createModuleInfo);
+		// renderPass stays null with dynamic rendering
+		auto targets = PipelineManager::Targets{swapChainImageFormat, msaaSamples, renderPass};
+		pipelines.create(device, *jobs, pipelineLayout, targets, shaderBinary(VERTEX_SHADER), shaderBinary(FRAGMENT_SHADER));
+		pipelines.prepare(scenePipeline);
 	}
 
 	void createRenderPass()
 	{
+		bool multisampled = msaaSamples != vk::SampleCountFlagBits::e1;
+
+		// with msaa the multisampled contents are resolved and then thrown away,
+		// so tile based gpus never write them to memory
 		auto colorAttachment = vk::AttachmentDescription(
 		    {},
 		    swapChainImageFormat,
-		    vk::SampleCountFlagBits::e1,
+		    msaaSamples,
 		    vk::AttachmentLoadOp::eClear,
+		    multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore,
+		    vk::AttachmentLoadOp::eDontCare,
+		    vk::AttachmentStoreOp::eDontCare,
+		    vk::ImageLayout::eUndefined,
+		    multisampled ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::ePresentSrcKHR);
+
+		auto resolveAttachment = vk::AttachmentDescription(
+		    {},
+		    swapChainImageFormat,
+		    vk::SampleCountFlagBits::e1,
+		    vk::AttachmentLoadOp::eDontCare,
 		    vk::AttachmentStoreOp::eStore,
 		    vk::AttachmentLoadOp::eDontCare,
 		    vk::AttachmentStoreOp::eDontCare,
 		    vk::ImageLayout::eUndefined,
 		    vk::ImageLayout::ePresentSrcKHR);
 
-		auto colorAttachmentRef = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+		auto colorAttachmentRef   = vk::AttachmentReference(0, vk::ImageLayout::eColorAttachmentOptimal);
+		auto resolveAttachmentRef = vk::AttachmentReference(1, vk::ImageLayout::eColorAttachmentOptimal);
 
 		auto subpass = vk::SubpassDescription(
 		    {},
@@ -464,7 +776,8 @@ class Vulkan
 		    0,         // input attachments count
 		    {},        // input attachments
 		    1,         // color attachment count,
-		    &colorAttachmentRef);
+		    &colorAttachmentRef,
+		    multisampled ? &resolveAttachmentRef : nullptr);
 
 		auto dependency = vk::SubpassDependency(
 		    vk::SubpassExternal,
@@ -474,10 +787,12 @@ class Vulkan
 		    {},        // srcAccessMask
 		    vk::AccessFlagBits::eColorAttachmentWrite);
 
+		vk::AttachmentDescription attachments[] = {colorAttachment, resolveAttachment};
+
 		auto createInfo = vk::RenderPassCreateInfo(
 		    {},
-		    1,        // attachment count
-		    &colorAttachment,
+		    multisampled ? 2 : 1,        // attachment count
+		    attachments,
 		    1,        // subpass count
 		    &subpass,
 		    1,        // dependency count
@@ -491,13 +806,23 @@ class Vulkan
 
 		for (size_t i = 0; i < swapChainImageViews.size(); i++)
 		{
-			vk::ImageView attachments[] = {
-			    swapChainImageViews[i]};
+			bool multisampled = msaaSamples != vk::SampleCountFlagBits::e1;
+
+			// the multisampled target is shared, each swapchain image is a resolve target
+			std::vector<vk::ImageView> attachments;
+			if (multisampled)
+			{
+				attachments = {colorImageView, swapChainImageViews[i]};
+			}
+			else
+			{
+				attachments = {swapChainImageViews[i]};
+			}
 
 			auto framebufferInfo            = vk::FramebufferCreateInfo();
 			framebufferInfo.renderPass      = renderPass;
-			framebufferInfo.attachmentCount = 1;
-			framebufferInfo.pAttachments    = attachments;
+			framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+			framebufferInfo.pAttachments    = attachments.data();
 			framebufferInfo.width           = swapChainExtent.width;
 			framebufferInfo.height          = swapChainExtent.height;
 			framebufferInfo.layers          = 1;
@@ -506,37 +831,26 @@ class Vulkan
 		}
 	}
 
-	void createCommandPool()
+	// the command buffer comes from the pool already recording, submit() ends it
+	void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
 	{
-		auto poolInfo             = vk::CommandPoolCreateInfo();
-		poolInfo.flags            = vk::CommandPoolCreateFlagBits::eResetCommandBuffer;
-		poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+		PROFILE_ZONE("recordCommandBuffer");
 
-		commandPool = device.createCommandPool(poolInfo);
-	}
+		gpuProfiler.beginFrame(commandBuffer, currentFrame);
+		auto frameZone = gpuProfiler.beginZone(commandBuffer, "frame");
 
-	void createCommandBuffers()
-	{
-		commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-
-		auto allocInfo               = vk::CommandBufferAllocateInfo();
-		allocInfo.commandPool        = commandPool;
-		allocInfo.level              = vk::CommandBufferLevel::ePrimary;
-		allocInfo.commandBufferCount = (uint32_t) commandBuffers.size();
+		currentImage = imageIndex;
+		if (dynamicRendering)
+		{
+			renderGraph.bindImage(swapChainTarget, swapChainImages[imageIndex], swapChainImageViews[imageIndex]);
+		}
+		renderGraph.execute(commandBuffer);
 
-		commandBuffers = device.allocateCommandBuffers(allocInfo);
+		gpuProfiler.endZone(commandBuffer, frameZone);
 	}
 
-	void recordCommandBuffer(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
+	void beginRenderPass(vk::CommandBuffer commandBuffer, uint32_t imageIndex)
 	{
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-
-		if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
-		{
-			throw std::runtime_error("failed to begin recording command buffer!");
-		}
-
 		VkRenderPassBeginInfo renderPassInfo{};
 		renderPassInfo.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 		renderPassInfo.renderPass        = renderPass;
@@ -549,6 +863,137 @@ class Vulkan
 		renderPassInfo.pClearValues    = &clearColor;
 
 		vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	}
+
+	// the render graph has transitioned the targets already
+	void beginDynamicRendering(vk::CommandBuffer commandBuffer)
+	{
+		auto colorAttachment        = vk::RenderingAttachmentInfo();
+		colorAttachment.imageView   = renderGraph.view(swapChainTarget);
+		colorAttachment.imageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+		colorAttachment.loadOp      = vk::AttachmentLoadOp::eClear;
+		colorAttachment.storeOp     = vk::AttachmentStoreOp::eStore;
+		colorAttachment.clearValue  = vk::ClearColorValue(0.0f, 0.0f, 0.0f, 1.0f);
+
+		if (msaaSamples != vk::SampleCountFlagBits::e1)
+		{
+			// resolved in-pass, the multisampled contents never leave tile memory
+			colorAttachment.resolveMode        = vk::ResolveModeFlagBits::eAverage;
+			colorAttachment.resolveImageView   = renderGraph.view(swapChainTarget);
+			colorAttachment.resolveImageLayout = vk::ImageLayout::eColorAttachmentOptimal;
+			colorAttachment.imageView          = renderGraph.view(multisampledTarget);
+			colorAttachment.storeOp            = vk::AttachmentStoreOp::eDontCare;
+		}
+
+		auto renderingInfo                 = vk::RenderingInfo();
+		renderingInfo.renderArea           = vk::Rect2D({0, 0}, swapChainExtent);
+		renderingInfo.layerCount           = 1;
+		renderingInfo.colorAttachmentCount = 1;
+		renderingInfo.pColorAttachments    = &colorAttachment;
+
+		commandBuffer.beginRendering(renderingInfo);
+	}
+
+	// Passes of a frame in submission order, the render graph places the
+	// barriers between them. The legacy render pass transitions its own
+	// attachments, so without dynamic rendering only the draw buffers are
+	// tracked by the graph.
+	void buildRenderGraph()
+	{
+		renderGraph.reset();
+
+		auto drawCommands = renderGraph.importBuffer("draw commands");
+
+		// copies are not allowed inside rendering, the managers place their own barriers
+		auto &uploads = renderGraph.addPass("uploads", [this](vk::CommandBuffer commandBuffer, RenderGraph &) {
+			streaming.recordUploads(commandBuffer);
+			textures.recordUploads(commandBuffer);
+		});
+		uploads.keepAlive();
+
+		if (gpuCulling && asyncCompute.isAsync())
+		{
+			// the semaphore orders it after the compute queue, the acquire leaves the draws readable
+			auto &acquire = renderGraph.addPass("acquire draws", [this](vk::CommandBuffer commandBuffer, RenderGraph &) {
+				asyncCompute.acquireBuffer(commandBuffer, drawBuffers[currentFrame], vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+				asyncCompute.acquireBuffer(commandBuffer, drawCountBuffers[currentFrame], vk::PipelineStageFlagBits::eDrawIndirect, vk::AccessFlagBits::eIndirectCommandRead);
+			});
+			acquire.write(drawCommands, STATE_INDIRECT_READ);
+		}
+		else if (gpuCulling)
+		{
+			auto &culling = renderGraph.addPass("culling", [this](vk::CommandBuffer commandBuffer, RenderGraph &) {
+				auto cullingZone = gpuProfiler.beginZone(commandBuffer, "culling");
+				recordCulling(commandBuffer);
+				gpuProfiler.endZone(commandBuffer, cullingZone);
+			});
+			culling.write(drawCommands, STATE_COMPUTE_WRITE);
+		}
+
+		auto &scene = renderGraph.addPass("scene", [this](vk::CommandBuffer commandBuffer, RenderGraph &) {
+			if (dynamicRendering)
+			{
+				beginDynamicRendering(commandBuffer);
+			}
+			else
+			{
+				beginRenderPass(commandBuffer, currentImage);
+			}
+
+			auto sceneZone = gpuProfiler.beginZone(commandBuffer, "scene");
+			drawScene(commandBuffer, cullingFrustum());
+			gpuProfiler.endZone(commandBuffer, sceneZone);
+
+			// same attachments, so no pass of their own
+			auto spritesZone = gpuProfiler.beginZone(commandBuffer, "sprites");
+			sprites.record(commandBuffer, swapChainExtent);
+			statsOverlay.record(commandBuffer, swapChainExtent);
+			gpuProfiler.endZone(commandBuffer, spritesZone);
+
+			if (dynamicRendering)
+			{
+				commandBuffer.endRendering();
+			}
+			else
+			{
+				commandBuffer.endRenderPass();
+			}
+		});
+
+		if (gpuCulling)
+		{
+			scene.read(drawCommands, STATE_INDIRECT_READ);
+		}
+
+		if (dynamicRendering)
+		{
+			swapChainTarget = renderGraph.importImage("swapchain", STATE_ACQUIRED, STATE_PRESENT);
+			renderGraph.markOutput(swapChainTarget);
+			scene.write(swapChainTarget, STATE_COLOR_ATTACHMENT);
+
+			if (msaaSamples != vk::SampleCountFlagBits::e1)
+			{
+				auto info          = TransientImageInfo();
+				info.format        = swapChainImageFormat;
+				info.extent        = swapChainExtent;
+				info.samples       = msaaSamples;
+				info.usage         = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+				multisampledTarget = renderGraph.createImage("multisampled color", info);
+				scene.write(multisampledTarget, STATE_COLOR_ATTACHMENT);
+			}
+		}
+		else
+		{
+			scene.keepAlive();
+		}
+
+		renderGraph.compile();
+	}
+
+	// draws all objects, shared by the render pass and dynamic rendering paths
+	void drawScene(vk::CommandBuffer commandBuffer, const Frustum &frustum)
+	{
+		auto lodProjection = LodProjection::fromMatrix(cullingMatrix(), static_cast<float>(swapChainExtent.height));
 
 		VkViewport viewport{};
 		viewport.x        = 0.0f;
@@ -564,45 +1009,219 @@ class Vulkan
 		scissor.extent = swapChainExtent;
 		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 
-		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, graphicsPipeline);
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipelines.get(scenePipeline));
+
+		// bound once, objects are selected through push constants
+		vk::DescriptorSet descriptorSets[] = {bindless.set, frameDescriptorSets[currentFrame]};
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout, 0, 2, descriptorSets, 0, nullptr);
 
 		vk::Buffer     vertexBuffers[] = {vertexBuffer};
 		vk::DeviceSize offsets[]       = {0};
 		commandBuffer.bindVertexBuffers(0, 1, &vertexBuffer, offsets);
+		commandBuffer.bindIndexBuffer(indexBuffer, 0, vk::IndexType::eUint32);
+
+		auto pushConstants         = PushConstants();
+		pushConstants.transform    = objectTransform;
+		pushConstants.objectBuffer = objectBufferIndices[currentFrame];
+		commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment, 0, sizeof(PushConstants), &pushConstants);
+
+		if (gpuCulling)
+		{
+			commandBuffer.drawIndexedIndirectCount(drawBuffers[currentFrame], 0,
+			                                       drawCountBuffers[currentFrame], 0,
+			                                       MAX_OBJECTS, sizeof(vk::DrawIndexedIndirectCommand));
+		}
+		else
+		{
+			// tests run on the job system, recording stays on this thread
+			jobs->parallelFor("cpu culling", objectCount, CPU_CULL_BATCH_SIZE, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++)
+				{
+					auto &object  = objects[i];
+					cpuVisible[i] = frustum.isSphereVisible(object.model, object.boundingSphere)
+					                    ? lodProjection.select(meshLods[object.mesh], object.model, object.boundingSphere) + 1
+					                    : 0;
+				}
+			});
+
+			// the instance index selects the object, same as firstInstance in the indirect path
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				if (cpuVisible[i])
+				{
+					auto &mesh = meshLods[objects[i].mesh];
+					auto &lod  = mesh.levels[cpuVisible[i] - 1];
+					commandBuffer.drawIndexed(lod.indexCount, 1, lod.firstIndex, mesh.vertexOffset, i);
+				}
+			}
+		}
+
+		drawStreamedChunks(commandBuffer, lodProjection);
+	}
+
+	// Writes every sprite into the frame's batch, split over the job system.
+	// Texture requests are not thread safe, so the slots of the texture files
+	// are resolved here first, once per run of sprites with the same texture.
+	void batchSprites()
+	{
+		PROFILE_ZONE("batch sprites");
 
-		vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+		sprites.begin(currentFrame);
 
-		vkCmdEndRenderPass(commandBuffer);
+		// the entry past the last texture file is the white texture
+		uint32_t textureCount = textures.textureCount();
+		spriteTextureSlots.assign(textureCount + 1, UINT32_MAX);
 
-		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+		uint32_t previous = UINT32_MAX;
+		for (const auto &sprite : spriteList)
 		{
-			throw std::runtime_error("failed to record command buffer!");
+			uint32_t texture = std::min(sprite.texture, textureCount);
+			if (texture != previous && spriteTextureSlots[texture] == UINT32_MAX)
+			{
+				spriteTextureSlots[texture] = textures.request(texture);
+			}
+			previous = texture;
 		}
+
+		uint32_t first;
+		uint32_t count = sprites.reserve(static_cast<uint32_t>(spriteList.size()), first);
+		jobs->parallelFor("batch sprites", count, SPRITE_BATCH_SIZE, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++)
+			{
+				auto &sprite = spriteList[i];
+				auto  slot   = spriteTextureSlots[std::min(sprite.texture, textureCount)];
+				sprites.set(first + static_cast<uint32_t>(i), sprite.position, sprite.size, slot, sprite.uvRect, sprite.color, sprite.layer, sprite.blend);
+			}
+		});
+
+		sprites.end();
 	}
 
-	void createSyncObjects()
+	// The time since the previous frame started and the bytes streaming and
+	// textures recorded for upload in it, then the overlay of this frame.
+	void updateStats()
 	{
-		imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-		inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+		auto     now      = std::chrono::steady_clock::now();
+		uint64_t uploaded = streaming.stats().bytesStreamed + textures.streamedBytes();
+		if (lastFrameStart != std::chrono::steady_clock::time_point())
+		{
+			stats.addFrame(std::chrono::duration<double, std::milli>(now - lastFrameStart).count(), uploaded - uploadedBytes);
+		}
+		lastFrameStart = now;
+		uploadedBytes  = uploaded;
 
-		VkSemaphoreCreateInfo semaphoreInfo{};
-		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		if (statsVisible)
+		{
+			refreshStats();
+		}
+		statsOverlay.update(currentFrame, stats, statsVisible);
+	}
+
+	void refreshStats()
+	{
+		PROFILE_ZONE("refresh stats");
+
+		stats.refreshHeaps(physicalDevice);
+
+		auto streamingStats  = streaming.stats();
+		auto submissionStats = submissions.stats();
+		auto computeStats    = asyncCompute.stats();
+		auto pipelineCount   = pipelines.pipelineCount() + sprites.pipelines.pipelineCount() + statsOverlay.batch.pipelines.pipelineCount() + (cullingPipeline ? 1 : 0);
+
+		stats.resources = {
+		    {"objects", objectCount},
+		    {"pipelines", pipelineCount},
+		    {"textures", textures.textureCount()},
+		    {"residentTextures", textures.residentCount()},
+		    {"residentChunks", streamingStats.residentChunks},
+		    {"chunkSlots", streamingStats.slots},
+		    {"sprites", sprites.spriteCount()},
+		    {"spriteDraws", sprites.drawCount()},
+		    {"bindlessStorageBuffers", bindless.storageBufferCount()},
+		    {"bindlessSampledImages", bindless.sampledImageCount()},
+		    {"swapChainImages", swapChainImages.size()},
+		    {"renderGraphPasses", renderGraph.livePassCount()},
+		    {"transientImageBytes", renderGraph.transientMemorySize()},
+		    {"fences", submissionStats.liveFences + computeStats.liveFences},
+		    {"semaphores", submissionStats.liveSemaphores + computeStats.liveSemaphores},
+		    {"commandBuffers", submissionStats.liveCommandBuffers + computeStats.liveCommandBuffers},
+		    {"pendingSubmissions", submissionStats.pendingSubmissions + computeStats.pendingSubmissions}};
+	}
 
-		VkFenceCreateInfo fenceInfo{};
-		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+	// Culls the streamed chunks against the bounds from their file headers
+	// and requests the visible ones before the uploads are recorded, so the
+	// eviction in recordUploads never picks a chunk this frame draws. Culled
+	// chunks are neither loaded nor marked as used.
+	void requestStreamedChunks(const Frustum &frustum)
+	{
+		visibleChunks.clear();
 
-		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		uint32_t count = std::min(static_cast<uint32_t>(streamedChunks.size()), MAX_OBJECTS - objectCount);
+		for (uint32_t i = 0; i < count; i++)
 		{
-			imageAvailableSemaphores[i] = device.createSemaphore(semaphoreInfo);
-			renderFinishedSemaphores[i] = device.createSemaphore(semaphoreInfo);
-			inFlightFences[i]           = device.createFence(fenceInfo);
+			auto &instance = streamedChunks[i];
+			if (instance.chunk >= streaming.chunkCount() || !frustum.isSphereVisible(instance.model, streaming.boundingSphere(instance.chunk)))
+			{
+				continue;
+			}
+
+			streaming.request(instance.chunk);
+			visibleChunks.push_back(i);
+		}
+	}
+
+	// Streamed chunks are few and large, so they are drawn one by one from
+	// their heap slots. Their objects follow the regular ones in the frame's
+	// object buffer, at a fixed index per instance.
+	void drawStreamedChunks(vk::CommandBuffer commandBuffer, const LodProjection &lodProjection)
+	{
+		for (uint32_t i : visibleChunks)
+		{
+			auto &instance = streamedChunks[i];
+			auto  chunk    = streaming.resident(instance.chunk);
+			if (chunk == nullptr)
+			{
+				continue;
+			}
+
+			uint32_t objectIndex  = objectCount + i;
+			auto    &object       = objectData[currentFrame][objectIndex];
+			object.model          = instance.model;
+			object.boundingSphere = chunk->boundingSphere;
+			object.tint           = instance.tint;
+			object.texture        = textures.request(instance.texture);
+
+			auto &lod = chunk->lods.levels[lodProjection.select(chunk->lods, instance.model, chunk->boundingSphere)];
+
+			commandBuffer.bindVertexBuffers(0, chunk->buffer, chunk->vertexOffset);
+			commandBuffer.bindIndexBuffer(chunk->buffer, chunk->indexOffset, vk::IndexType::eUint32);
+			commandBuffer.drawIndexed(lod.indexCount, 1, lod.firstIndex, 0, objectIndex);
+		}
+	}
+
+	// Present waits on these without a fence, so they are per swap chain
+	// image: by the time an image is acquired again its previous present
+	// has consumed the semaphore. They go back to the pool with the swap chain.
+	void createRenderFinishedSemaphores()
+	{
+		for (size_t i = 0; i < swapChainImages.size(); i++)
+		{
+			renderFinishedSemaphores.push_back(submissions.acquireSemaphore());
 		}
 	}
 
 	void cleanupSwapChain()
 	{
+		renderGraph.reset();
+
+		if (colorImageView)
+		{
+			device.destroyImageView(colorImageView);
+			device.destroyImage(colorImage);
+			GpuMemory::free(device, colorImageMemory);
+			colorImageView = nullptr;
+		}
+
 		for (auto framebuffer : swapChainFramebuffers)
 		{
 			vkDestroyFramebuffer(device, framebuffer, nullptr);
@@ -614,45 +1233,459 @@ class Vulkan
 		}
 
 		vkDestroySwapchainKHR(device, swapChain, nullptr);
+
+		for (auto semaphore : renderFinishedSemaphores)
+		{
+			submissions.releaseSemaphore(semaphore);
+		}
+		renderFinishedSemaphores.clear();
 	}
 
 	void recreateSwapChain()
 	{
-		int width = 0, height = 0;
-		// todo part of window api in renderer should not be here
-		glfwGetFramebufferSize(window, &width, &height);
-		while (width == 0 || height == 0)
+		// minimized, drawFrame recreates it once the window has a size again
+		if (framebufferWidth == 0 || framebufferHeight == 0)
 		{
-			glfwGetFramebufferSize(window, &width, &height);
-			glfwWaitEvents();
+			framebufferResized = true;
+			return;
 		}
 
+		PROFILE_ZONE("recreateSwapChain");
+
 		vkDeviceWaitIdle(device);
 
 		cleanupSwapChain();
 
 		createSwapChain();
 		createImageViews();
-		createFramebuffers();
+		createRenderFinishedSemaphores();
+		if (!dynamicRendering)
+		{
+			createColorResources();
+			createFramebuffers();
+		}
+		buildRenderGraph();
 	}
 
-	void createVertexBuffer()
+	// buffers accessed from several queue families are created with concurrent sharing
+	void createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties, vk::Buffer &buffer, vk::DeviceMemory &bufferMemory,
+	                  const std::vector<uint32_t> &queueFamilies = {})
 	{
-		auto bufferInfo = vk::BufferCreateInfo({}, sizeof(vertices[0]) * vertices.size(), vk::BufferUsageFlagBits::eVertexBuffer);
+		auto bufferInfo = vk::BufferCreateInfo({}, size, usage);
+		if (queueFamilies.size() > 1)
+		{
+			bufferInfo.sharingMode           = vk::SharingMode::eConcurrent;
+			bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+			bufferInfo.pQueueFamilyIndices   = queueFamilies.data();
+		}
 
-		vertexBuffer = device.createBuffer(bufferInfo);
+		buffer = device.createBuffer(bufferInfo);
 
-		auto memRequirements = device.getBufferMemoryRequirements(vertexBuffer);
+		auto memRequirements = device.getBufferMemoryRequirements(buffer);
 
-		auto memoryIndex = DeviceHelpers::findMemoryType(physicalDevice, memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+		auto memoryIndex = DeviceHelpers::findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
 		auto allocInfo   = vk::MemoryAllocateInfo(memRequirements.size, memoryIndex);
 
-		vertexBufferMemory = device.allocateMemory(allocInfo);
-		device.bindBufferMemory(vertexBuffer, vertexBufferMemory, 0);
+		bufferMemory = GpuMemory::allocate(device, allocInfo);
+		device.bindBufferMemory(buffer, bufferMemory, 0);
+	}
+
+	void createVertexBuffer()
+	{
+		vk::DeviceSize size = sizeof(vertices[0]) * vertices.size();
+
+		createBuffer(size,
+		             vk::BufferUsageFlagBits::eVertexBuffer,
+		             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		             vertexBuffer,
+		             vertexBufferMemory);
 
 		void *data;
-		data = device.mapMemory(vertexBufferMemory, 0, bufferInfo.size);
-		memcpy(data, vertices.data(), (size_t) bufferInfo.size);
+		data = device.mapMemory(vertexBufferMemory, 0, size);
+		memcpy(data, vertices.data(), (size_t) size);
 		device.unmapMemory(vertexBufferMemory);
 	}
+
+	void createMeshBuffer()
+	{
+		vk::DeviceSize size = sizeof(MeshLods) * MAX_LOD_MESHES;
+
+		createBuffer(size,
+		             vk::BufferUsageFlagBits::eStorageBuffer,
+		             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		             meshBuffer,
+		             meshBufferMemory,
+		             computeQueueFamilies());
+
+		meshData = static_cast<MeshLods *>(device.mapMemory(meshBufferMemory, 0, size));
+
+		meshBufferIndex = bindless.registerStorageBuffer(meshBuffer);
+	}
+
+	// returns the index objects refer to the mesh by
+	uint32_t addMesh(const MeshLods &lods)
+	{
+		if (meshLods.size() >= MAX_LOD_MESHES)
+		{
+			throw std::runtime_error("too many meshes!");
+		}
+
+		meshData[meshLods.size()] = lods;
+		meshLods.push_back(lods);
+		return static_cast<uint32_t>(meshLods.size()) - 1;
+	}
+
+	void createObjectBuffers()
+	{
+		vk::DeviceSize size = sizeof(ObjectData) * MAX_OBJECTS;
+
+		objectBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		objectBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		objectData.resize(MAX_FRAMES_IN_FLIGHT);
+		objectBufferIndices.resize(MAX_FRAMES_IN_FLIGHT);
+		objectBufferVersions.assign(MAX_FRAMES_IN_FLIGHT, 0);
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			createBuffer(size,
+			             vk::BufferUsageFlagBits::eStorageBuffer,
+			             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			             objectBuffers[i],
+			             objectBuffersMemory[i],
+			             computeQueueFamilies());
+
+			objectData[i]          = static_cast<ObjectData *>(device.mapMemory(objectBuffersMemory[i], 0, size));
+			objectBufferIndices[i] = bindless.registerStorageBuffer(objectBuffers[i]);
+		}
+	}
+
+	// no frame in flight reads the frame's buffer anymore
+	void updateObjectBuffer(uint32_t frame)
+	{
+		if (objectBufferVersions[frame] == objectsVersion)
+		{
+			return;
+		}
+
+		memcpy(objectData[frame], objects.data(), sizeof(ObjectData) * objectCount);
+		objectBufferVersions[frame] = objectsVersion;
+	}
+
+	void createFrameDescriptorSetLayout()
+	{
+		auto uboBinding = vk::DescriptorSetLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex);
+
+		auto layoutInfo          = vk::DescriptorSetLayoutCreateInfo({}, 1, &uboBinding);
+		frameDescriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+	}
+
+	void createUniformBuffers()
+	{
+		vk::DeviceSize size = sizeof(FrameUniforms);
+
+		uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			createBuffer(size,
+			             vk::BufferUsageFlagBits::eUniformBuffer,
+			             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			             uniformBuffers[i],
+			             uniformBuffersMemory[i]);
+
+			// stays mapped for the lifetime of the buffer
+			uniformBuffersMapped[i] = static_cast<FrameUniforms *>(device.mapMemory(uniformBuffersMemory[i], 0, size));
+		}
+	}
+
+	void createFrameDescriptorSets()
+	{
+		auto poolSize = vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, MAX_FRAMES_IN_FLIGHT);
+		auto poolInfo = vk::DescriptorPoolCreateInfo({}, MAX_FRAMES_IN_FLIGHT, 1, &poolSize);
+
+		frameDescriptorPool = device.createDescriptorPool(poolInfo);
+
+		std::vector<vk::DescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, frameDescriptorSetLayout);
+
+		auto allocInfo      = vk::DescriptorSetAllocateInfo(frameDescriptorPool, static_cast<uint32_t>(layouts.size()), layouts.data());
+		frameDescriptorSets = device.allocateDescriptorSets(allocInfo);
+
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			auto bufferInfo = vk::DescriptorBufferInfo(uniformBuffers[i], 0, sizeof(FrameUniforms));
+			auto write      = vk::WriteDescriptorSet(frameDescriptorSets[i], 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &bufferInfo);
+			device.updateDescriptorSets(1, &write, 0, nullptr);
+		}
+	}
+
+	void updateUniformBuffer(uint32_t frame)
+	{
+		// keep the scene undistorted when the window is not square
+		float aspect = swapChainExtent.width / (float) swapChainExtent.height;
+
+		frameUniforms.view = glm::mat4(1.0f);
+		frameUniforms.proj = glm::ortho(-aspect, aspect, -1.0f, 1.0f);
+
+		memcpy(uniformBuffersMapped[frame], &frameUniforms, sizeof(frameUniforms));
+	}
+
+	// levels of detail are generated offline by --write-chunks, the built-in triangle has nothing to simplify
+	void createIndexBuffer()
+	{
+		vk::DeviceSize size = sizeof(vertexIndices[0]) * vertexIndices.size();
+
+		createBuffer(size,
+		             vk::BufferUsageFlagBits::eIndexBuffer,
+		             vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		             indexBuffer,
+		             indexBufferMemory);
+
+		void *data;
+		data = device.mapMemory(indexBufferMemory, 0, size);
+		memcpy(data, vertexIndices.data(), (size_t) size);
+		device.unmapMemory(indexBufferMemory);
+
+		triangleMesh.lods           = addMesh(singleLod(static_cast<uint32_t>(vertexIndices.size())));
+		triangleMesh.boundingSphere = computeBoundingSphere(vertices);
+	}
+
+	void createCullingPipeline()
+	{
+		gpuCulling = DeviceSelector::capabilities(physicalDevice).gpuCulling;
+		if (!gpuCulling)
+		{
+			std::cout << "Indirect count draws are not supported, culling on the CPU\n";
+			return;
+		}
+
+		auto pushConstantRange = vk::PushConstantRange(vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants));
+
+		auto pipelineLayoutInfo = vk::PipelineLayoutCreateInfo({}, 1, &bindless.layout, 1, &pushConstantRange);
+		cullingPipelineLayout   = device.createPipelineLayout(pipelineLayoutInfo);
+
+		cullingPipeline = buildCullingPipeline();
+	}
+
+	vk::Pipeline buildCullingPipeline()
+	{
+		auto cullShaderModule = loadShaderModule(device, shaderBinary(CULL_SHADER));
+
+		auto stageInfo    = vk::PipelineShaderStageCreateInfo({}, vk::ShaderStageFlagBits::eCompute, cullShaderModule, "main");
+		auto pipelineInfo = vk::ComputePipelineCreateInfo({}, stageInfo, cullingPipelineLayout);
+
+		auto pipeline = device.createComputePipeline(nullptr, pipelineInfo).value;
+
+		device.destroyShaderModule(cullShaderModule);
+
+		return pipeline;
+	}
+
+	// Rebuilds the pipelines whose shaders the watcher recompiled. Runs at a
+	// frame boundary, so no command buffer is being recorded; the replaced
+	// pipelines may still be used by frames in flight and are destroyed once
+	// those finished, instead of waiting for the device to go idle.
+	void reloadShaders()
+	{
+		while (!retiredPipelines.empty() && retiredPipelines.front().frame + MAX_FRAMES_IN_FLIGHT <= frameNumber)
+		{
+			device.destroyPipeline(retiredPipelines.front().pipeline);
+			retiredPipelines.pop_front();
+		}
+
+		if (!shaderWatcher)
+		{
+			return;
+		}
+
+		bool        graphicsChanged = false;
+		bool        cullingChanged  = false;
+		bool        spritesChanged  = false;
+		std::string shader;
+		while (shaderWatcher->changed(shader))
+		{
+			graphicsChanged |= shader == VERTEX_SHADER || shader == FRAGMENT_SHADER;
+			cullingChanged |= shader == CULL_SHADER;
+			spritesChanged |= shader == SPRITE_VERTEX_SHADER || shader == SPRITE_FRAGMENT_SHADER;
+		}
+
+		if (!graphicsChanged && !cullingChanged && !spritesChanged)
+		{
+			return;
+		}
+
+		PROFILE_ZONE("reload shaders");
+
+		// a shader that compiles can still fail to link against the layout, the old pipeline stays then
+		try
+		{
+			if (graphicsChanged)
+			{
+				for (auto pipeline : pipelines.reload())
+				{
+					retiredPipelines.push_back({pipeline, frameNumber});
+				}
+			}
+			if (spritesChanged)
+			{
+				for (auto pipeline : sprites.pipelines.reload())
+				{
+					retiredPipelines.push_back({pipeline, frameNumber});
+				}
+				for (auto pipeline : statsOverlay.batch.pipelines.reload())
+				{
+					retiredPipelines.push_back({pipeline, frameNumber});
+				}
+			}
+			if (cullingChanged && gpuCulling)
+			{
+				replacePipeline(cullingPipeline, buildCullingPipeline());
+			}
+		}
+		catch (const std::exception &e)
+		{
+			std::cout << "Failed to rebuild pipeline: " << e.what() << "\n";
+		}
+	}
+
+	void replacePipeline(vk::Pipeline &current, vk::Pipeline replacement)
+	{
+		retiredPipelines.push_back({current, frameNumber});
+		current = replacement;
+	}
+
+	void createDrawBuffers()
+	{
+		if (!gpuCulling)
+		{
+			return;
+		}
+
+		drawBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		drawBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		drawBufferIndices.resize(MAX_FRAMES_IN_FLIGHT);
+		drawCountBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+		drawCountBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+		drawCountBufferIndices.resize(MAX_FRAMES_IN_FLIGHT);
+
+		// written by the culling pass of the frame, so one set per frame in flight
+		for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+		{
+			createBuffer(sizeof(vk::DrawIndexedIndirectCommand) * MAX_OBJECTS,
+			             vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+			             vk::MemoryPropertyFlagBits::eDeviceLocal,
+			             drawBuffers[i],
+			             drawBuffersMemory[i]);
+
+			createBuffer(sizeof(uint32_t),
+			             vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer | vk::BufferUsageFlagBits::eTransferDst,
+			             vk::MemoryPropertyFlagBits::eDeviceLocal,
+			             drawCountBuffers[i],
+			             drawCountBuffersMemory[i]);
+
+			drawBufferIndices[i]      = bindless.registerStorageBuffer(drawBuffers[i]);
+			drawCountBufferIndices[i] = bindless.registerStorageBuffer(drawCountBuffers[i]);
+		}
+	}
+
+	// tests every object against the frustum, picks its level of detail and compacts the visible ones into the draw buffer
+	void recordCulling(vk::CommandBuffer commandBuffer)
+	{
+		commandBuffer.fillBuffer(drawCountBuffers[currentFrame], 0, sizeof(uint32_t), 0);
+
+		auto clearBarrier = vk::MemoryBarrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eShaderRead | vk::AccessFlagBits::eShaderWrite);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eComputeShader, {}, clearBarrier, nullptr, nullptr);
+
+		commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullingPipeline);
+		commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullingPipelineLayout, 0, 1, &bindless.set, 0, nullptr);
+
+		auto constants         = CullConstants();
+		constants.cullMatrix   = cullingMatrix();
+		constants.lodScale     = LodProjection::lodScaleOf(constants.cullMatrix, static_cast<float>(swapChainExtent.height));
+		constants.objectBuffer = objectBufferIndices[currentFrame];
+		constants.drawBuffer   = drawBufferIndices[currentFrame];
+		constants.countBuffer  = drawCountBufferIndices[currentFrame];
+		constants.meshBuffer   = meshBufferIndex;
+		constants.objectCount  = objectCount;
+		commandBuffer.pushConstants(cullingPipelineLayout, vk::ShaderStageFlagBits::eCompute, 0, sizeof(CullConstants), &constants);
+
+		commandBuffer.dispatch((objectCount + CULL_WORKGROUP_SIZE - 1) / CULL_WORKGROUP_SIZE, 1, 1);
+
+		// on the graphics queue the render graph makes the draws visible to the scene pass,
+		// on the compute queue the semaphore and the matching acquire do
+		if (asyncCompute.isAsync())
+		{
+			asyncCompute.releaseBuffer(commandBuffer, drawBuffers[currentFrame], vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+			asyncCompute.releaseBuffer(commandBuffer, drawCountBuffers[currentFrame], vk::PipelineStageFlagBits::eComputeShader, vk::AccessFlagBits::eShaderWrite);
+		}
+	}
+
+	// from the space the object model matrices are in to clip space
+	glm::mat4 cullingMatrix()
+	{
+		return frameUniforms.proj * frameUniforms.view * objectTransform;
+	}
+
+	Frustum cullingFrustum()
+	{
+		return Frustum::fromMatrix(cullingMatrix());
+	}
+
+	void createColorResources()
+	{
+		if (msaaSamples == vk::SampleCountFlagBits::e1)
+		{
+			return;
+		}
+
+		auto imageInfo          = vk::ImageCreateInfo();
+		imageInfo.imageType     = vk::ImageType::e2D;
+		imageInfo.format        = swapChainImageFormat;
+		imageInfo.extent        = vk::Extent3D(swapChainExtent.width, swapChainExtent.height, 1);
+		imageInfo.mipLevels     = 1;
+		imageInfo.arrayLayers   = 1;
+		imageInfo.samples       = msaaSamples;
+		imageInfo.tiling        = vk::ImageTiling::eOptimal;
+		imageInfo.usage         = vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment;
+		imageInfo.sharingMode   = vk::SharingMode::eExclusive;
+		imageInfo.initialLayout = vk::ImageLayout::eUndefined;
+
+		colorImage = device.createImage(imageInfo);
+
+		// lazily allocated memory is only committed if the driver spills the tile, prefer it when there is one
+		auto memRequirements = device.getImageMemoryRequirements(colorImage);
+		auto properties      = vk::MemoryPropertyFlags(vk::MemoryPropertyFlagBits::eDeviceLocal);
+		if (DeviceHelpers::hasMemoryType(physicalDevice, memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eLazilyAllocated))
+		{
+			properties = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+		}
+
+		auto memoryIndex = DeviceHelpers::findMemoryType(physicalDevice, memRequirements.memoryTypeBits, properties);
+		auto allocInfo   = vk::MemoryAllocateInfo(memRequirements.size, memoryIndex);
+
+		colorImageMemory = GpuMemory::allocate(device, allocInfo);
+		device.bindImageMemory(colorImage, colorImageMemory, 0);
+
+		auto viewInfo = vk::ImageViewCreateInfo(
+		    {},
+		    colorImage,
+		    vk::ImageViewType::e2D,
+		    swapChainImageFormat,
+		    vk::ComponentMapping(),
+		    vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+		colorImageView = device.createImageView(viewInfo);
+	}
+
+	// families reading host written data that the compute queue also reads
+	std::vector<uint32_t> computeQueueFamilies()
+	{
+		if (asyncCompute.isAsync())
+		{
+			return {indices.graphicsFamily.value(), indices.computeFamily.value()};
+		}
+
+		return {};
+	}
 };
\ No newline at end of file